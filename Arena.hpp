@@ -0,0 +1,113 @@
+#pragma once
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Trace.hpp"
+
+namespace tok
+{
+    /**
+     * A bump allocator owning every object made from it. Nothing is freed on
+     * its own; reset() releases all objects at once and keeps the memory for
+     * the next use, so an arena that is reused reaches a steady size.
+     **/
+    struct Arena
+    {
+    private:
+        struct Block
+        {
+            std::unique_ptr<char[]> memory;
+            std::size_t size;
+        };
+        // Objects that need their destructor run on reset.
+        struct Destructor
+        {
+            void (*destroy)(void *);
+            void *object;
+        };
+        std::vector<Block> blocks;
+        std::vector<Destructor> destructors;
+        std::size_t blockSize;
+        // The block that is currently allocated from and the offset into it.
+        std::size_t current = 0;
+        std::size_t offset = 0;
+
+    public:
+        explicit Arena(std::size_t blockSize = 4096) : blockSize(blockSize)
+        {
+        }
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+        ~Arena()
+        {
+            this->reset();
+        }
+        /**
+         * Return size bytes of memory aligned to align.
+         **/
+        void *allocate(std::size_t size, std::size_t align)
+        {
+            TOK_COUNT(allocations, 1);
+            TOK_COUNT(allocatedBytes, size);
+            while (this->current < this->blocks.size())
+            {
+                Block &block = this->blocks[this->current];
+                std::size_t start = (this->offset + align - 1) & ~(align - 1);
+                if (start + size <= block.size)
+                {
+                    this->offset = start + size;
+                    return block.memory.get() + start;
+                }
+                this->current++;
+                this->offset = 0;
+            }
+            std::size_t bytes = std::max(this->blockSize, size + align);
+            this->blocks.push_back({std::unique_ptr<char[]>(new char[bytes]), bytes});
+            // The new block is current now and starts out aligned for anything.
+            this->offset = size;
+            return this->blocks.back().memory.get();
+        }
+        /**
+         * Construct an object in the arena. It lives until the next reset().
+         **/
+        template <class T, class... Args>
+        T *make(Args &&...args)
+        {
+            T *object = new (this->allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+            if (!std::is_trivially_destructible<T>::value)
+                this->destructors.push_back({[](void *p) { static_cast<T *>(p)->~T(); }, object});
+            return object;
+        }
+        /**
+         * Release every object made from the arena. The memory itself is kept
+         * and handed out again by the following allocations.
+         **/
+        void reset()
+        {
+            for (auto it = this->destructors.rbegin(); it != this->destructors.rend(); it++)
+                it->destroy(it->object);
+            this->destructors.clear();
+            this->current = 0;
+            this->offset = 0;
+        }
+        /**
+         * The number of bytes the arena holds on to.
+         **/
+        std::size_t capacity() const
+        {
+            std::size_t bytes = 0;
+            for (const Block &block : this->blocks)
+                bytes += block.size;
+            return bytes;
+        }
+    };
+}
+
+#endif
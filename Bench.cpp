@@ -0,0 +1,457 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+#include "Token.hpp"
+#include "Program.hpp"
+#include "Optimizer.hpp"
+#include "ThreadPool.hpp"
+#include "Workbook.hpp"
+#include "Binary.hpp"
+
+using namespace std;
+
+// Every allocation of the process is counted, so that the stages can be
+// measured in allocations per expression as well.
+namespace
+{
+    atomic<uint64_t> allocations{0};
+}
+void *operator new(size_t size)
+{
+    allocations.fetch_add(1, memory_order_relaxed);
+    if (void *memory = malloc(size ? size : 1))
+        return memory;
+    throw bad_alloc();
+}
+void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+void operator delete(void *memory, size_t) noexcept
+{
+    free(memory);
+}
+
+/**
+ * The evaluation the threaded interpreter replaced: one object per postfix
+ * token, a virtual call per token and a std::deque as the stack.
+ **/
+namespace
+{
+    struct Op
+    {
+        virtual ~Op() = default;
+        virtual void evaluate(deque<double> &stack) const = 0;
+    };
+    struct Push : Op
+    {
+        const double *value;
+        explicit Push(const double *value) : value(value) {}
+        void evaluate(deque<double> &stack) const override
+        {
+            stack.push_front(*this->value);
+        }
+    };
+    struct Unary : Op
+    {
+        tok::OPCODE op;
+        explicit Unary(tok::OPCODE op) : op(op) {}
+        void evaluate(deque<double> &stack) const override
+        {
+            stack.front() = tok::apply(this->op, stack.front(), 0.0);
+        }
+    };
+    struct Binary : Op
+    {
+        tok::OPCODE op;
+        explicit Binary(tok::OPCODE op) : op(op) {}
+        void evaluate(deque<double> &stack) const override
+        {
+            double operand2 = stack.front();
+            stack.pop_front();
+            stack.front() = tok::apply(this->op, stack.front(), operand2);
+        }
+    };
+    vector<unique_ptr<Op>> tokens(const tok::CompiledExpression &program, const vector<double> &bindings)
+    {
+        vector<unique_ptr<Op>> ops;
+        for (const tok::Instruction &ins : program.getProgram())
+        {
+            if (ins.op == tok::OPCODE::CONST)
+                ops.emplace_back(new Push(&program.getConstants()[ins.arg]));
+            else if (ins.op == tok::OPCODE::LOAD)
+                ops.emplace_back(new Push(&bindings[ins.arg]));
+            else if (tok::operands(ins.op) == 1)
+                ops.emplace_back(new Unary(ins.op));
+            else
+                ops.emplace_back(new Binary(ins.op));
+        }
+        return ops;
+    }
+    // Keeps the results alive so that the work is not optimized away.
+    volatile double sink;
+
+    struct Result
+    {
+        string section;
+        string name;
+        string input;
+        // Per operation:
+        double ns;
+        double allocations;
+        // Operations per second.
+        double throughput;
+    };
+    vector<Result> results;
+
+    /**
+     * Run f often enough to take at least 50 ms and record the time and the
+     * allocations per call of the last round.
+     **/
+    template <typename F>
+    void measure(const string &section, const string &name, const string &input, F f)
+    {
+        for (size_t n = 1;; n *= 2)
+        {
+            uint64_t before = allocations.load(memory_order_relaxed);
+            auto start = chrono::steady_clock::now();
+            for (size_t i = 0; i < n; i++)
+                sink = f();
+            chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+            if (elapsed.count() >= 5e7)
+            {
+                double ns = elapsed.count() / n;
+                results.push_back({section, name, input, ns, (double)(allocations.load(memory_order_relaxed) - before) / n, 1e9 / ns});
+                return;
+            }
+        }
+    }
+    struct Input
+    {
+        string name;
+        string expr;
+    };
+    vector<Input> corpus()
+    {
+        string longSum, nested = "x", variables;
+        for (int i = 0; i < 500; i++)
+            longSum += (i ? "+" : "") + string(i % 2 ? "x*" : "y/") + to_string(i % 9 + 1) + ".5";
+        for (int i = 0; i < 100; i++)
+            nested = "(" + nested + (i % 2 ? "*" : "+") + to_string(i % 7 + 1) + ")";
+        for (int i = 0; i < 200; i++)
+            variables += (i ? (i % 3 ? "+" : "*") : "") + string("v") + to_string(i);
+        return {{"short", "x*2+y"},
+                {"mixed", "(a+b)*(c-d)/(e+f)-(g*h+i)%j&&!k"},
+                {"long", longSum},
+                {"nested", nested},
+                {"bitwise", "(a&0xFF|b%7)&(c|d&15)"},
+                {"variables", variables}};
+    }
+    vector<double> ones(const tok::CompiledExpression &program)
+    {
+        vector<double> bindings(program.getSymbols().size());
+        for (size_t slot = 0; slot < bindings.size(); slot++)
+            bindings[slot] = 1.0 + slot % 5;
+        return bindings;
+    }
+    /**
+     * Every stage of compiling and evaluating an expression on its own.
+     **/
+    void stages(const vector<Input> &inputs)
+    {
+        tok::CompileOptions options;
+        options.jitThreshold = 0;
+        for (const Input &input : inputs)
+        {
+            tok::Arena arena;
+            measure("stage", "tokenization", input.name, [&]() {
+                arena.reset();
+                tok::SymbolTable symbols;
+                return (double)tok::tokenization(input.expr, symbols, arena).size();
+            });
+            tok::Arena tokenArena;
+            tok::SymbolTable symbols;
+            vector<tok::Token *> tokens = tok::tokenization(input.expr, symbols, tokenArena);
+            measure("stage", "infixtopostfix", input.name, [&]() { return (double)tok::infixtopostfix(tokens).size(); });
+            measure("stage", "infixtopostfixO", input.name, [&]() { return (double)tok::infixtopostfixO(tokens).size(); });
+            measure("stage", "infixtopostfix+assemble", input.name, [&]() { return (double)tok::assemble(tok::infixtopostfix(tokens), symbols).size(); });
+            measure("stage", "parse", input.name, [&]() { return (double)tok::parse(tokens, symbols).size(); });
+            vector<tok::Token *> postfix = tok::infixtopostfix(tokens);
+            measure("stage", "assemble", input.name, [&]() { return (double)tok::assemble(postfix, symbols).size(); });
+            tok::CompiledExpression plain = tok::assemble(postfix, symbols);
+            measure("stage", "optimize", input.name, [&]() { return (double)tok::optimize(plain, options).size(); });
+            tok::CompiledExpression program = tok::compile(input.expr, options);
+            vector<double> bindings = ones(program);
+            measure("stage", "evaluate", input.name, [&]() { return program.run(bindings); });
+            measure("stage", "compile", input.name, [&]() { return (double)tok::compile(input.expr, options).size(); });
+        }
+    }
+    /**
+     * Compiling every expression of the corpus against loading it from a
+     * program file written beforehand.
+     **/
+    void startup(const vector<Input> &inputs)
+    {
+        tok::CompileOptions options;
+        options.jitThreshold = 0;
+        vector<tok::CompiledExpression> programs;
+        vector<const tok::CompiledExpression *> pointers;
+        vector<string_view> sources;
+        for (const Input &input : inputs)
+        {
+            programs.push_back(tok::compile(input.expr, options));
+            sources.push_back(input.expr);
+        }
+        for (const tok::CompiledExpression &program : programs)
+            pointers.push_back(&program);
+        char path[] = "/tmp/benchXXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0)
+            return;
+        {
+            tok::BufferedWriter writer(fd);
+            writer.write(tok::serialize(sources, pointers));
+        }
+        close(fd);
+        {
+            tok::ProgramFile file(path);
+            for (size_t k = 0; k < inputs.size(); k++)
+            {
+                measure("startup", "compile", inputs[k].name, [&]() { return (double)tok::compile(inputs[k].expr, options).size(); });
+                measure("startup", "load", inputs[k].name, [&]() { return (double)file.load(k, options).size(); });
+            }
+            measure("startup", "open", to_string(inputs.size()) + " programs", [&]() { return (double)tok::ProgramFile(path).size(); });
+        }
+        unlink(path);
+    }
+    /**
+     * The former per-token virtual dispatch against the threaded code, with
+     * and without superinstructions.
+     **/
+    void interpreter(const vector<Input> &inputs)
+    {
+        for (const Input &input : inputs)
+        {
+            tok::CompileOptions options;
+            options.jitThreshold = 0;
+            // Without CSE, so that every program has the shape of its source.
+            options.cse = false;
+            tok::CompiledExpression fused = tok::compile(input.expr, options);
+            options.superinstructions = false;
+            tok::CompiledExpression plain = tok::compile(input.expr, options);
+            vector<double> bindings = ones(plain);
+            vector<unique_ptr<Op>> ops = tokens(plain, bindings);
+            deque<double> stack;
+            measure("interpreter", "virtual", input.name, [&]() {
+                for (const unique_ptr<Op> &op : ops)
+                    op->evaluate(stack);
+                double result = stack.front();
+                stack.pop_front();
+                return result;
+            });
+            measure("interpreter", "threaded", input.name, [&]() { return plain.run(bindings); });
+            measure("interpreter", "superinstructions", input.name, [&]() { return fused.run(bindings); });
+        }
+    }
+    /**
+     * A large batch on 1 to N threads, measured per row.
+     **/
+    void scaling(size_t rows)
+    {
+        tok::CompileOptions options;
+        options.jitThreshold = 0;
+        tok::CompiledExpression program = tok::compile("(a+b)*(c-d)/(a*c+1)-(b%7|d&3)", options);
+        vector<vector<double>> columns(program.getSymbols().size(), vector<double>(rows));
+        vector<const double *> pointers;
+        for (size_t slot = 0; slot < columns.size(); slot++)
+        {
+            for (size_t row = 0; row < rows; row++)
+                columns[slot][row] = (double)(row % 1000) / (slot + 1);
+            pointers.push_back(columns[slot].data());
+        }
+        vector<double> out(rows);
+        for (size_t threads = 1; threads <= max(thread::hardware_concurrency(), 1u); threads++)
+        {
+            tok::ThreadPool pool(threads);
+            size_t before = results.size();
+            measure("parallel", "threads=" + to_string(threads), to_string(rows) + " rows", [&]() {
+                program.run(pointers.data(), rows, out.data(), pool);
+                return out[0];
+            });
+            results[before].ns /= rows;
+            results[before].allocations /= rows;
+            results[before].throughput *= rows;
+        }
+    }
+    /**
+     * Thousands of formulas over a few hundred inputs of which one changes
+     * at a time: updating a workbook against evaluating every formula again.
+     **/
+    void workbook(size_t formulas, size_t inputs)
+    {
+        tok::CompileOptions options;
+        options.jitThreshold = 0;
+        tok::Workbook book(options);
+        vector<tok::CompiledExpression> programs;
+        vector<string> names;
+        for (size_t k = 0; k < formulas; k++)
+        {
+            string a = "v" + to_string(k % inputs), b = "v" + to_string(k * 7 % inputs), c = "v" + to_string(k * 13 % inputs);
+            string expr = "(" + a + "-" + b + ")/" + a + "*max(" + c + "," + b + ")+" + to_string(k % 10);
+            book.add(expr);
+            programs.push_back(tok::compile(expr, options));
+        }
+        unordered_map<string, double> values;
+        for (size_t slot = 0; slot < inputs; slot++)
+        {
+            names.push_back("v" + to_string(slot));
+            values[names.back()] = 1.0 + slot % 5;
+        }
+        book.set(values);
+        vector<vector<double>> bindings;
+        for (const tok::CompiledExpression &program : programs)
+            bindings.push_back(program.bind(values));
+        string input = to_string(formulas) + " formulas";
+        size_t tick = 0;
+        measure("workbook", "update", input, [&]() {
+            tick++;
+            return (double)book.set(names[tick % inputs], (double)(tick % 1000));
+        });
+        cerr << "workbook: " << book.getNodes() << " nodes, " << (double)book.recomputed() / book.updates()
+             << " recomputed per update" << endl;
+        measure("workbook", "evaluate all", input, [&]() {
+            double sum = 0;
+            for (size_t k = 0; k < programs.size(); k++)
+                sum += programs[k].run(bindings[k]);
+            return sum;
+        });
+    }
+    /**
+     * A set of rules over the same derived quantities, compiled one by one
+     * against compiled into one program, measured per row.
+     **/
+    void rules(size_t count, size_t rows)
+    {
+        tok::CompileOptions options;
+        options.jitThreshold = 0;
+        vector<string> exprs;
+        vector<string_view> views;
+        const string margin = "(price-cost)/price";
+        for (size_t k = 0; k < count; k++)
+        {
+            string limit = to_string(k % 50) + ".5";
+            exprs.push_back(k % 2 ? margin + "*qty" + to_string(k % 7) + "&&" + limit : "max(" + margin + ",tax*qty" + to_string(k % 7) + ")-" + limit);
+        }
+        for (const string &expr : exprs)
+            views.push_back(expr);
+        vector<tok::CompiledExpression> programs;
+        for (const string &expr : exprs)
+            programs.push_back(tok::compile(expr, options));
+        tok::CompiledExpression fused = tok::compile(views, options);
+        vector<vector<double>> columns(fused.getSymbols().size(), vector<double>(rows));
+        for (size_t slot = 0; slot < columns.size(); slot++)
+        {
+            for (size_t row = 0; row < rows; row++)
+                columns[slot][row] = 1.0 + (double)(row % 97) / (slot + 1);
+        }
+        vector<vector<double>> out(count, vector<double>(rows));
+        vector<double *> outputs;
+        for (vector<double> &column : out)
+            outputs.push_back(column.data());
+        string input = to_string(count) + " rules";
+        size_t before = results.size();
+        measure("rules", "one by one", input, [&]() {
+            vector<const double *> pointers;
+            for (size_t k = 0; k < count; k++)
+            {
+                const tok::SymbolTable &symbols = programs[k].getSymbols();
+                pointers.clear();
+                for (size_t slot = 0; slot < symbols.size(); slot++)
+                    pointers.push_back(columns[fused.getSymbols().find(symbols.getName(slot))].data());
+                programs[k].run(pointers.data(), rows, outputs[k]);
+            }
+            return out[0][0];
+        });
+        vector<const double *> pointers;
+        for (const vector<double> &column : columns)
+            pointers.push_back(column.data());
+        vector<double> last(rows);
+        measure("rules", "fused", input, [&]() {
+            fused.run(pointers.data(), rows, last.data(), outputs.data());
+            return out[0][0];
+        });
+        for (size_t i = before; i < results.size(); i++)
+        {
+            results[i].ns /= rows;
+            results[i].allocations /= rows;
+            results[i].throughput *= rows;
+        }
+    }
+    string quote(const string &text)
+    {
+        string quoted = "\"";
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                quoted += '\\';
+            quoted += c;
+        }
+        return quoted + "\"";
+    }
+    void print(ostream &out, bool json)
+    {
+        if (!json)
+        {
+            out << "section\tname\tinput\tns/op\tallocs/op\tops/s" << endl;
+            for (const Result &result : results)
+                out << result.section << '\t' << result.name << '\t' << result.input << '\t' << result.ns << '\t'
+                    << result.allocations << '\t' << result.throughput << endl;
+            return;
+        }
+        out << "{\"results\": [" << endl;
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Result &result = results[i];
+            out << "  {\"section\": " << quote(result.section) << ", \"name\": " << quote(result.name)
+                << ", \"input\": " << quote(result.input) << ", \"ns\": " << result.ns
+                << ", \"allocations\": " << result.allocations << ", \"throughput\": " << result.throughput << "}"
+                << (i + 1 != results.size() ? "," : "") << endl;
+        }
+        out << "]}" << endl;
+    }
+}
+
+/**
+ * bench.exe [--json] [--rows n]
+ * Build with `make release` to measure the optimized build.
+ **/
+int main(int argc, char **argv)
+{
+    bool json = false;
+    size_t rows = 4000000;
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "--json")
+            json = true;
+        else if (string(argv[i]) == "--rows" && i + 1 < argc)
+            rows = stoul(argv[++i]);
+    }
+    vector<Input> inputs = corpus();
+    stages(inputs);
+    startup(inputs);
+    interpreter(inputs);
+    scaling(rows);
+    workbook(5000, 300);
+    rules(5000, 4096);
+    print(cout, json);
+}
@@ -0,0 +1,280 @@
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <unistd.h>
+#include <unordered_map>
+#include "Binary.hpp"
+#include "Functions.hpp"
+
+namespace
+{
+    const char MAGIC[8] = {'T', 'O', 'K', 'P', 'R', 'O', 'G', '\0'};
+    struct Header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t count;
+        // The size of the whole image and the checksum of everything behind
+        // the header.
+        std::uint64_t size;
+        std::uint64_t checksum;
+    };
+    struct RecordHeader
+    {
+        std::uint32_t instructions;
+        std::uint32_t constants;
+        std::uint32_t symbols;
+        std::uint32_t functions;
+        std::uint32_t source;
+        std::uint32_t reserved;
+    };
+    static_assert(sizeof(Header) % 8 == 0 && sizeof(RecordHeader) % 8 == 0, "The sections have to stay aligned");
+
+    // FNV-1a over the bytes.
+    std::uint64_t checksum(const char *data, std::size_t size)
+    {
+        std::uint64_t hash = 0xCBF29CE484222325ull;
+        for (std::size_t i = 0; i < size; i++)
+            hash = (hash ^ (unsigned char)data[i]) * 0x100000001B3ull;
+        return hash;
+    }
+    void put(std::string &image, const void *data, std::size_t size)
+    {
+        image.append((const char *)data, size);
+    }
+    void align(std::string &image)
+    {
+        image.resize((image.size() + 7) & ~(std::size_t)7);
+    }
+    void putString(std::string &image, std::string_view text)
+    {
+        std::uint32_t length = text.size();
+        put(image, &length, sizeof(length));
+        put(image, text.data(), text.size());
+    }
+    [[noreturn]] void corrupt()
+    {
+        throw std::runtime_error("Corrupt program file");
+    }
+    /**
+     * Reads the sections of a record in order, checking that each of them
+     * ends before the file does.
+     **/
+    struct Reader
+    {
+        const char *at;
+        const char *end;
+
+        const char *take(std::size_t size)
+        {
+            if ((std::size_t)(this->end - this->at) < size)
+                corrupt();
+            const char *start = this->at;
+            this->at += size;
+            return start;
+        }
+        std::string_view string()
+        {
+            std::uint32_t length;
+            std::memcpy(&length, this->take(sizeof(length)), sizeof(length));
+            return std::string_view(this->take(length), length);
+        }
+    };
+}
+std::string tok::serialize(const std::vector<std::string_view> &sources, const std::vector<const tok::CompiledExpression *> &programs)
+{
+    if (sources.size() != programs.size())
+        throw std::invalid_argument("Every program needs its source");
+    std::string image(sizeof(Header) + 8 * programs.size(), '\0');
+    std::vector<std::uint64_t> offsets;
+    for (std::size_t k = 0; k < programs.size(); k++)
+    {
+        const tok::CompiledExpression &program = *programs[k];
+        offsets.push_back(image.size());
+        // The functions are stored by name, their indices only hold within
+        // one process.
+        std::vector<tok::Instruction> instructions = program.getProgram();
+        std::vector<std::uint32_t> functions;
+        std::unordered_map<std::uint32_t, std::uint32_t> calls;
+        for (tok::Instruction &ins : instructions)
+        {
+            if (ins.op != tok::OPCODE::CALL)
+                continue;
+            auto it = calls.emplace(ins.arg, functions.size());
+            if (it.second)
+                functions.push_back(ins.arg);
+            ins.arg = it.first->second;
+        }
+        RecordHeader header{(std::uint32_t)instructions.size(), (std::uint32_t)program.getConstants().size(),
+                            (std::uint32_t)program.getSymbols().size(), (std::uint32_t)functions.size(),
+                            (std::uint32_t)sources[k].size(), 0};
+        put(image, &header, sizeof(header));
+        put(image, instructions.data(), instructions.size() * sizeof(tok::Instruction));
+        put(image, program.getConstants().data(), program.getConstants().size() * sizeof(double));
+        for (std::size_t i = 0; i < instructions.size(); i++)
+        {
+            std::uint32_t position = program.getPosition(i);
+            put(image, &position, sizeof(position));
+        }
+        align(image);
+        put(image, sources[k].data(), sources[k].size());
+        for (unsigned slot = 0; slot < program.getSymbols().size(); slot++)
+            putString(image, program.getSymbols().getName(slot));
+        for (std::uint32_t function : functions)
+            putString(image, tok::function(function).name);
+        align(image);
+    }
+    std::memcpy(&image[sizeof(Header)], offsets.data(), 8 * offsets.size());
+    Header header;
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = tok::BINARY_VERSION;
+    header.count = programs.size();
+    header.size = image.size();
+    header.checksum = checksum(image.data() + sizeof(Header), image.size() - sizeof(Header));
+    std::memcpy(&image[0], &header, sizeof(header));
+    return image;
+}
+std::size_t tok::precompile(const std::string &input, const std::string &output, const tok::CompileOptions &options)
+{
+    tok::MappedFile file(input);
+    std::string_view text(file.data, file.size);
+    std::vector<std::string_view> sources;
+    std::vector<tok::CompiledExpression> programs;
+    for (std::size_t line = 1; !text.empty(); line++)
+    {
+        std::size_t end = text.find('\n');
+        std::string_view expr = text.substr(0, end);
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+        if (!expr.empty() && expr.back() == '\r')
+            expr.remove_suffix(1);
+        if (expr.find_first_not_of(" \t") == std::string_view::npos)
+            continue;
+        try
+        {
+            programs.push_back(tok::compile(expr, options));
+        }
+        catch (const std::invalid_argument &e)
+        {
+            throw std::invalid_argument("Line " + std::to_string(line) + ": " + e.what());
+        }
+        sources.push_back(expr);
+    }
+    std::vector<const tok::CompiledExpression *> pointers;
+    for (const tok::CompiledExpression &program : programs)
+        pointers.push_back(&program);
+    std::string image = tok::serialize(sources, pointers);
+    int fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open " + output);
+    {
+        tok::BufferedWriter writer(fd);
+        writer.write(image);
+    }
+    close(fd);
+    return programs.size();
+}
+tok::ProgramFile::ProgramFile(const std::string &path) : file(path)
+{
+    Header header;
+    if (this->file.size < sizeof(Header))
+        corrupt();
+    std::memcpy(&header, this->file.data, sizeof(header));
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+        throw std::runtime_error(path + " is not a program file");
+    if (header.version != tok::BINARY_VERSION)
+        throw std::runtime_error(path + " has version " + std::to_string(header.version) + " rather than " + std::to_string(tok::BINARY_VERSION));
+    if (header.size != this->file.size || (this->file.size - sizeof(Header)) / 8 < header.count)
+        corrupt();
+    if (checksum(this->file.data + sizeof(Header), this->file.size - sizeof(Header)) != header.checksum)
+        throw std::runtime_error("The checksum of " + path + " does not match");
+    this->count = header.count;
+}
+const char *tok::ProgramFile::record(std::size_t index, const char *&end) const
+{
+    if (index >= this->count)
+        throw std::out_of_range("No program " + std::to_string(index));
+    std::uint64_t offset;
+    std::memcpy(&offset, this->file.data + sizeof(Header) + 8 * index, sizeof(offset));
+    if (offset % 8 != 0 || offset > this->file.size || this->file.size - offset < sizeof(RecordHeader))
+        corrupt();
+    end = this->file.data + this->file.size;
+    return this->file.data + offset;
+}
+std::string_view tok::ProgramFile::source(std::size_t index) const
+{
+    const char *end;
+    Reader reader{this->record(index, end), end};
+    RecordHeader header;
+    std::memcpy(&header, reader.take(sizeof(header)), sizeof(header));
+    std::size_t positions = (4 * (std::size_t)header.instructions + 7) & ~(std::size_t)7;
+    reader.take(8 * (std::size_t)header.instructions + 8 * (std::size_t)header.constants + positions);
+    return std::string_view(reader.take(header.source), header.source);
+}
+tok::CompiledExpression tok::ProgramFile::load(std::size_t index, const tok::CompileOptions &options) const
+{
+    const char *end;
+    Reader reader{this->record(index, end), end};
+    RecordHeader header;
+    std::memcpy(&header, reader.take(sizeof(header)), sizeof(header));
+    // Nothing is sized from the counts before they are known to fit, every
+    // name takes at least its length.
+    std::uint64_t needed = 12 * (std::uint64_t)header.instructions + 8 * (std::uint64_t)header.constants + header.source +
+                           4 * ((std::uint64_t)header.symbols + header.functions);
+    if (needed > (std::uint64_t)(reader.end - reader.at))
+        corrupt();
+    std::vector<tok::Instruction> program(header.instructions);
+    std::vector<double> constants(header.constants);
+    std::vector<unsigned> positions(header.instructions);
+    std::memcpy(program.data(), reader.take(program.size() * sizeof(tok::Instruction)), program.size() * sizeof(tok::Instruction));
+    std::memcpy(constants.data(), reader.take(constants.size() * sizeof(double)), constants.size() * sizeof(double));
+    const char *stored = reader.take((4 * positions.size() + 7) & ~(std::size_t)7);
+    for (std::size_t i = 0; i < positions.size(); i++)
+    {
+        std::uint32_t position;
+        std::memcpy(&position, stored + 4 * i, sizeof(position));
+        positions[i] = position;
+    }
+    reader.take(header.source);
+    tok::SymbolTable symbols;
+    for (std::uint32_t slot = 0; slot < header.symbols; slot++)
+    {
+        // Every name gets the next slot, unless it is there twice.
+        if (symbols.resolve(reader.string()) != slot)
+            corrupt();
+    }
+    std::vector<std::uint32_t> functions;
+    for (std::uint32_t k = 0; k < header.functions; k++)
+    {
+        std::string_view name = reader.string();
+        int function = tok::findFunction(name);
+        if (function < 0)
+            throw std::runtime_error("Unknown function " + std::string(name));
+        functions.push_back(function);
+    }
+    // The instructions have to stay within the tables, verify() checks the
+    // stack. There cannot be more temporaries or outputs than instructions.
+    for (tok::Instruction &ins : program)
+    {
+        if ((std::size_t)ins.op >= tok::OPCODES)
+            corrupt();
+        if ((ins.op == tok::OPCODE::STORE || ins.op == tok::OPCODE::RECALL || ins.op == tok::OPCODE::YIELD) && ins.arg > program.size())
+            corrupt();
+        if (ins.op == tok::OPCODE::CONST && ins.arg >= constants.size())
+            corrupt();
+        if (ins.op == tok::OPCODE::LOAD && ins.arg >= header.symbols)
+            corrupt();
+        if (ins.op == tok::OPCODE::CALL)
+        {
+            if (ins.arg >= functions.size())
+                corrupt();
+            ins.arg = functions[ins.arg];
+            if (ins.aux != tok::function(ins.arg).arity)
+                throw std::runtime_error("The function " + std::string(tok::function(ins.arg).name) + " takes another number of arguments");
+        }
+    }
+    tok::CompiledExpression result(std::move(program), std::move(constants), std::move(positions), std::move(symbols));
+    if (!options.superinstructions)
+        result.thread(false);
+    result.enableJit(options.jitThreshold);
+    return result;
+}
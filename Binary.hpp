@@ -0,0 +1,69 @@
+#pragma once
+#ifndef BINARY_H
+#define BINARY_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "Program.hpp"
+#include "Stream.hpp"
+
+namespace tok
+{
+    /**
+     * The version of the format serialize() writes. Files of another version
+     * are rejected rather than guessed at.
+     **/
+    const std::uint32_t BINARY_VERSION = 1;
+    /**
+     * Write the programs and the source they were compiled from into one
+     * image: a header with a checksum over the rest, the offsets of the
+     * records and one record per program with its instructions, constants,
+     * source positions, variable names and the names of the functions it
+     * calls. Every offset is relative to the start of the image and every
+     * section is aligned to 8 bytes, so the image can be mapped anywhere.
+     * Numbers are stored in the byte order of the machine.
+     **/
+    std::string serialize(const std::vector<std::string_view> &sources, const std::vector<const tok::CompiledExpression *> &programs);
+    /**
+     * Compile every non-empty line of the input file and write the image of
+     * all of them to the output file. Returns the number of expressions.
+     * Throws std::invalid_argument citing the line of the first expression
+     * that does not compile.
+     **/
+    std::size_t precompile(const std::string &input, const std::string &output, const tok::CompileOptions &options = tok::CompileOptions());
+    /**
+     * A file serialize() wrote, mapped into memory. The header and checksum
+     * are validated once when it is opened, after that a program is loaded
+     * straight from the sections of its record without tokenizing or parsing
+     * anything. Throws std::runtime_error for a file that is not valid.
+     **/
+    struct ProgramFile
+    {
+    private:
+        tok::MappedFile file;
+        std::uint32_t count = 0;
+
+        // The start of the given record and where the file ends.
+        const char *record(std::size_t index, const char *&end) const;
+
+    public:
+        explicit ProgramFile(const std::string &path);
+        inline std::size_t size() const
+        {
+            return this->count;
+        }
+        /**
+         * The source of the given program, viewing into the mapping.
+         **/
+        std::string_view source(std::size_t index) const;
+        /**
+         * Rebuild the given program, ready to run. Calls are resolved to the
+         * functions registered under the same names in this process.
+         **/
+        tok::CompiledExpression load(std::size_t index, const tok::CompileOptions &options = tok::CompileOptions()) const;
+    };
+}
+
+#endif
@@ -0,0 +1,134 @@
+#include <mutex>
+#include "Cache.hpp"
+#include "Token.hpp"
+
+tok::ExpressionCache::ExpressionCache(std::size_t capacity, std::size_t shards, const tok::CompileOptions &options)
+    : shards(std::max<std::size_t>(shards, 1)), options(options)
+{
+    this->shardCapacity = std::max<std::size_t>(capacity / this->shards.size(), 1);
+}
+tok::ExpressionCache::Shard &tok::ExpressionCache::shardOf(std::string_view text)
+{
+    std::size_t hash = std::hash<std::string_view>()(text);
+    // The low bits pick the bucket inside the shard already.
+    return this->shards[(hash >> 17) % this->shards.size()];
+}
+std::shared_ptr<const tok::CompiledExpression> tok::ExpressionCache::get(std::string_view expr)
+{
+    thread_local std::string buffer;
+    std::string_view text = normalize(expr, buffer);
+    Shard &shard = this->shardOf(text);
+    {
+        std::shared_lock<std::shared_mutex> reader(shard.lock);
+        auto it = shard.entries.find(text);
+        if (it != shard.entries.end())
+        {
+            it->second->lastUse.store(shard.clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+            shard.hits.fetch_add(1, std::memory_order_relaxed);
+            return it->second->program;
+        }
+    }
+    shard.misses.fetch_add(1, std::memory_order_relaxed);
+    // Compile outside of the lock, another thread may add the same text meanwhile.
+    std::unique_ptr<Entry> entry(new Entry);
+    entry->text = std::string(text);
+    // The text the caller wrote is compiled, so that an error cites its
+    // positions rather than the ones of the key.
+    entry->program = std::make_shared<const tok::CompiledExpression>(tok::compile(expr, this->options));
+    entry->lastUse.store(shard.clock.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+    std::unique_lock<std::shared_mutex> writer(shard.lock);
+    auto it = shard.entries.find(text);
+    if (it != shard.entries.end())
+        return it->second->program;
+    if (shard.entries.size() >= this->shardCapacity)
+    {
+        auto oldest = shard.entries.begin();
+        for (auto candidate = shard.entries.begin(); candidate != shard.entries.end(); candidate++)
+        {
+            if (candidate->second->lastUse.load(std::memory_order_relaxed) < oldest->second->lastUse.load(std::memory_order_relaxed))
+                oldest = candidate;
+        }
+        shard.entries.erase(oldest);
+        shard.evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+    std::shared_ptr<const tok::CompiledExpression> program = entry->program;
+    std::string_view key = entry->text;
+    shard.entries.emplace(key, std::move(entry));
+    return program;
+}
+// Whitespace only matters between two characters that would otherwise run
+// into one token: an identifier or literal, && or ||, or the exponent of a
+// literal like 1e-5. 1e- 5 is not a literal, so the space after the sign of
+// an exponent stays as well.
+std::string_view tok::ExpressionCache::normalize(std::string_view expr, std::string &buffer)
+{
+    auto isSpace = [](char c) { return c == ' ' || c == '\r' || c == '\n'; };
+    auto isWord = [](char c) { return tok::isLetter(c) || tok::isDigit(c) || c == '_' || c == '.'; };
+    auto joins = [&](char a, char b) {
+        return (isWord(a) && isWord(b)) || (a == '&' && b == '&') || (a == '|' && b == '|') ||
+               ((a == 'e' || a == 'E') && (b == '+' || b == '-'));
+    };
+    auto exponent = [&](const std::string &text) {
+        std::size_t n = text.size();
+        return n >= 3 && (text[n - 1] == '+' || text[n - 1] == '-') && (text[n - 2] == 'e' || text[n - 2] == 'E') &&
+               (tok::isDigit(text[n - 3]) || text[n - 3] == '.');
+    };
+    std::size_t first = 0;
+    while (first != expr.size() && !isSpace(expr[first]))
+        first++;
+    // Most expressions are normalized already and are used as they are.
+    if (first == expr.size())
+        return expr;
+    buffer.assign(expr.data(), first);
+    for (std::size_t i = first; i < expr.size(); i++)
+    {
+        if (!isSpace(expr[i]))
+        {
+            buffer.push_back(expr[i]);
+            continue;
+        }
+        std::size_t next = i;
+        while (next != expr.size() && isSpace(expr[next]))
+            next++;
+        if (!buffer.empty() && next != expr.size() && (joins(buffer.back(), expr[next]) || (exponent(buffer) && isWord(expr[next]))))
+            buffer.push_back(' ');
+        i = next - 1;
+    }
+    return buffer;
+}
+std::uint64_t tok::ExpressionCache::hits() const
+{
+    std::uint64_t hits = 0;
+    for (const Shard &shard : this->shards)
+        hits += shard.hits.load(std::memory_order_relaxed);
+    return hits;
+}
+std::uint64_t tok::ExpressionCache::misses() const
+{
+    std::uint64_t misses = 0;
+    for (const Shard &shard : this->shards)
+        misses += shard.misses.load(std::memory_order_relaxed);
+    return misses;
+}
+std::uint64_t tok::ExpressionCache::evictions() const
+{
+    std::uint64_t evictions = 0;
+    for (const Shard &shard : this->shards)
+        evictions += shard.evictions.load(std::memory_order_relaxed);
+    return evictions;
+}
+std::size_t tok::ExpressionCache::size() const
+{
+    std::size_t size = 0;
+    for (const Shard &shard : this->shards)
+    {
+        std::shared_lock<std::shared_mutex> reader(shard.lock);
+        size += shard.entries.size();
+    }
+    return size;
+}
+tok::ExpressionCache &tok::cache()
+{
+    static tok::ExpressionCache cache;
+    return cache;
+}
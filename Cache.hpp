@@ -0,0 +1,76 @@
+#pragma once
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "Program.hpp"
+
+namespace tok
+{
+    /**
+     * A bounded cache of compiled programs keyed by the normalized expression
+     * text. The entries are spread over shards that each have their own
+     * reader/writer lock, so a hit only takes one shared lock and concurrent
+     * readers never wait for each other. Eviction is least recently used,
+     * judged by a per-shard use counter that hits bump atomically.
+     **/
+    struct ExpressionCache
+    {
+    private:
+        struct Entry
+        {
+            std::string text;
+            std::shared_ptr<const tok::CompiledExpression> program;
+            std::atomic<std::uint64_t> lastUse{0};
+        };
+        // Aligned so that the counters of neighbouring shards do not share a cache line.
+        struct alignas(64) Shard
+        {
+            mutable std::shared_mutex lock;
+            // The keys view into the text of their entry.
+            std::unordered_map<std::string_view, std::unique_ptr<Entry>> entries;
+            std::atomic<std::uint64_t> clock{0};
+            std::atomic<std::uint64_t> hits{0};
+            std::atomic<std::uint64_t> misses{0};
+            std::atomic<std::uint64_t> evictions{0};
+        };
+        std::vector<Shard> shards;
+        std::size_t shardCapacity;
+        tok::CompileOptions options;
+
+        Shard &shardOf(std::string_view text);
+
+    public:
+        explicit ExpressionCache(std::size_t capacity = 4096, std::size_t shards = 16, const tok::CompileOptions &options = tok::CompileOptions());
+        ExpressionCache(const ExpressionCache &) = delete;
+        ExpressionCache &operator=(const ExpressionCache &) = delete;
+        /**
+         * Return the compiled program of the expression, compiling and adding
+         * it first if it is not cached yet.
+         **/
+        std::shared_ptr<const tok::CompiledExpression> get(std::string_view expr);
+        /**
+         * Remove the whitespace that does not separate two tokens, so that
+         * expressions differing only in spacing share one entry. The result
+         * is only the key, the expression is compiled as it was written.
+         **/
+        static std::string_view normalize(std::string_view expr, std::string &buffer);
+        std::uint64_t hits() const;
+        std::uint64_t misses() const;
+        std::uint64_t evictions() const;
+        std::size_t size() const;
+    };
+    /**
+     * The cache tok::eval compiles through.
+     **/
+    tok::ExpressionCache &cache();
+}
+
+#endif
@@ -0,0 +1,125 @@
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include "Functions.hpp"
+
+tok::FunctionEntry tok::registered[tok::MAX_FUNCTIONS - tok::BUILTIN_COUNT];
+std::atomic<unsigned> tok::registeredCount{0};
+namespace
+{
+    std::mutex registering;
+    // Owns the names of the registered functions, a deque never moves them.
+    std::deque<std::string> names;
+
+    // The loops are kept free of calls where possible, so that the compiler
+    // can vectorize them.
+    template <typename F>
+    inline void unary(double *arguments, std::size_t rows, F f)
+    {
+        for (std::size_t r = 0; r < rows; r++)
+            arguments[r] = f(arguments[r]);
+    }
+    template <typename F>
+    inline void binary(double *arguments, std::size_t stride, std::size_t rows, F f)
+    {
+        const double *second = arguments + stride;
+        for (std::size_t r = 0; r < rows; r++)
+            arguments[r] = f(arguments[r], second[r]);
+    }
+}
+double tok::clamp(const double *arguments)
+{
+    return tok::minimum(tok::maximum(arguments[0], arguments[1]), arguments[2]);
+}
+void tok::sinBatch(double *arguments, std::size_t, std::size_t rows)
+{
+    unary(arguments, rows, [](double x) { return std::sin(x); });
+}
+void tok::cosBatch(double *arguments, std::size_t, std::size_t rows)
+{
+    unary(arguments, rows, [](double x) { return std::cos(x); });
+}
+void tok::expBatch(double *arguments, std::size_t, std::size_t rows)
+{
+    unary(arguments, rows, [](double x) { return std::exp(x); });
+}
+void tok::logBatch(double *arguments, std::size_t, std::size_t rows)
+{
+    unary(arguments, rows, [](double x) { return std::log(x); });
+}
+void tok::sqrtBatch(double *arguments, std::size_t, std::size_t rows)
+{
+    unary(arguments, rows, [](double x) { return std::sqrt(x); });
+}
+void tok::powBatch(double *arguments, std::size_t stride, std::size_t rows)
+{
+    binary(arguments, stride, rows, [](double x, double y) { return std::pow(x, y); });
+}
+void tok::minBatch(double *arguments, std::size_t stride, std::size_t rows)
+{
+    binary(arguments, stride, rows, tok::minimum);
+}
+void tok::maxBatch(double *arguments, std::size_t stride, std::size_t rows)
+{
+    binary(arguments, stride, rows, tok::maximum);
+}
+void tok::absBatch(double *arguments, std::size_t, std::size_t rows)
+{
+    unary(arguments, rows, [](double x) { return std::fabs(x); });
+}
+void tok::clampBatch(double *arguments, std::size_t stride, std::size_t rows)
+{
+    const double *low = arguments + stride;
+    const double *high = arguments + 2 * stride;
+    for (std::size_t r = 0; r < rows; r++)
+        arguments[r] = tok::minimum(tok::maximum(arguments[r], low[r]), high[r]);
+}
+void tok::floorBatch(double *arguments, std::size_t, std::size_t rows)
+{
+    unary(arguments, rows, [](double x) { return std::floor(x); });
+}
+int tok::findFunction(std::string_view name)
+{
+    int index = tok::findBuiltin(name);
+    if (index >= 0)
+        return index;
+    unsigned count = tok::registeredCount.load(std::memory_order_acquire);
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (tok::registered[i].name == name)
+            return tok::BUILTIN_COUNT + i;
+    }
+    return -1;
+}
+unsigned tok::calls(unsigned index, unsigned arguments, unsigned position)
+{
+    const tok::FunctionEntry &function = tok::function(index);
+    if (arguments == function.arity)
+        return 1;
+    if (!function.variadic || arguments < function.arity)
+        throw std::invalid_argument(std::string(function.name) + " takes " + std::to_string(function.arity) +
+                                    (function.variadic ? " or more" : "") + " arguments, not " +
+                                    std::to_string(arguments) + " at " + std::to_string(position));
+    // Every call takes arity arguments and leaves one behind:
+    return 1 + (arguments - function.arity + function.arity - 2) / (function.arity - 1);
+}
+unsigned tok::registerFunction(std::string_view name, unsigned arity, tok::ScalarFunction scalar,
+                               tok::BatchFunction batch, bool pure)
+{
+    std::lock_guard<std::mutex> guard(registering);
+    if (tok::findFunction(name) >= 0)
+        throw std::invalid_argument("There already is a function " + std::string(name));
+    if (!scalar)
+        throw std::invalid_argument("The function " + std::string(name) + " needs a scalar implementation");
+    if (arity > tok::MAX_ARITY)
+        throw std::invalid_argument("Functions take at most " + std::to_string(tok::MAX_ARITY) + " arguments");
+    unsigned count = tok::registeredCount.load(std::memory_order_relaxed);
+    if (tok::BUILTIN_COUNT + count >= tok::MAX_FUNCTIONS)
+        throw std::invalid_argument("There is no room for another function");
+    names.emplace_back(name);
+    tok::registered[count] = {names.back(), arity, false, pure, scalar, batch};
+    // Published only once the entry is complete:
+    tok::registeredCount.store(count + 1, std::memory_order_release);
+    return tok::BUILTIN_COUNT + count;
+}
@@ -0,0 +1,127 @@
+#pragma once
+#ifndef FUNCTIONS_H
+#define FUNCTIONS_H
+
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <string_view>
+
+namespace tok
+{
+    // The result of a function applied to its arguments, arguments[0] first.
+    typedef double (*ScalarFunction)(const double *arguments);
+    // The same for a block of rows: the i-th argument of row r is
+    // arguments[i * stride + r], the result of row r replaces arguments[r].
+    typedef void (*BatchFunction)(double *arguments, std::size_t stride, std::size_t rows);
+    /**
+     * A function that expressions can call. Calls are resolved to the index of
+     * their entry while compiling, so evaluating one is a plain call through
+     * the pointer of that entry.
+     **/
+    struct FunctionEntry
+    {
+        std::string_view name;
+        unsigned arity;
+        // Whether it also takes more arguments than its arity, folding them
+        // from the right: max(a, b, c) = max(a, max(b, c)).
+        bool variadic;
+        // Whether the same arguments always give the same result, so that
+        // calls with constant arguments are folded and equal calls shared.
+        bool pure;
+        ScalarFunction scalar;
+        // Optional, calls fall back to the scalar function row by row.
+        BatchFunction batch;
+    };
+    // The most arguments a function may declare, as many as a node of an
+    // ExpressionGraph has operands.
+    const unsigned MAX_ARITY = 3;
+    // The most functions there can be, built-in and registered.
+    const unsigned MAX_FUNCTIONS = 256;
+
+    /**
+     * min and max as every path computes them. A NaN loses to a number and
+     * -0 is less than +0, so neither the order of the operands nor the way
+     * a compiler lowers the comparison changes the result.
+     **/
+    inline double minimum(double x, double y)
+    {
+        return x < y || (x == y && std::signbit(x)) || y != y ? x : y;
+    }
+    inline double maximum(double x, double y)
+    {
+        return x > y || (x == y && !std::signbit(x)) || y != y ? x : y;
+    }
+    double clamp(const double *arguments);
+    void sinBatch(double *arguments, std::size_t stride, std::size_t rows);
+    void cosBatch(double *arguments, std::size_t stride, std::size_t rows);
+    void expBatch(double *arguments, std::size_t stride, std::size_t rows);
+    void logBatch(double *arguments, std::size_t stride, std::size_t rows);
+    void sqrtBatch(double *arguments, std::size_t stride, std::size_t rows);
+    void powBatch(double *arguments, std::size_t stride, std::size_t rows);
+    void minBatch(double *arguments, std::size_t stride, std::size_t rows);
+    void maxBatch(double *arguments, std::size_t stride, std::size_t rows);
+    void absBatch(double *arguments, std::size_t stride, std::size_t rows);
+    void clampBatch(double *arguments, std::size_t stride, std::size_t rows);
+    void floorBatch(double *arguments, std::size_t stride, std::size_t rows);
+    /**
+     * The functions every expression can call, in the order of their indices.
+     **/
+    inline constexpr tok::FunctionEntry BUILTINS[] = {
+        {"sin", 1, false, true, [](const double *a) { return std::sin(a[0]); }, tok::sinBatch},
+        {"cos", 1, false, true, [](const double *a) { return std::cos(a[0]); }, tok::cosBatch},
+        {"exp", 1, false, true, [](const double *a) { return std::exp(a[0]); }, tok::expBatch},
+        {"log", 1, false, true, [](const double *a) { return std::log(a[0]); }, tok::logBatch},
+        {"sqrt", 1, false, true, [](const double *a) { return std::sqrt(a[0]); }, tok::sqrtBatch},
+        {"pow", 2, false, true, [](const double *a) { return std::pow(a[0], a[1]); }, tok::powBatch},
+        {"min", 2, true, true, [](const double *a) { return tok::minimum(a[0], a[1]); }, tok::minBatch},
+        {"max", 2, true, true, [](const double *a) { return tok::maximum(a[0], a[1]); }, tok::maxBatch},
+        {"abs", 1, false, true, [](const double *a) { return std::fabs(a[0]); }, tok::absBatch},
+        {"clamp", 3, false, true, tok::clamp, tok::clampBatch},
+        {"floor", 1, false, true, [](const double *a) { return std::floor(a[0]); }, tok::floorBatch}};
+    const unsigned BUILTIN_COUNT = sizeof(BUILTINS) / sizeof(BUILTINS[0]);
+    /**
+     * The index of the built-in function with the given name, or -1.
+     **/
+    constexpr int findBuiltin(std::string_view name)
+    {
+        for (unsigned index = 0; index < tok::BUILTIN_COUNT; index++)
+        {
+            if (tok::BUILTINS[index].name == name)
+                return index;
+        }
+        return -1;
+    }
+    static_assert(tok::findBuiltin("clamp") == 9, "The built-ins are looked up at compile time");
+    // The functions registered at run time, at their index minus BUILTIN_COUNT.
+    extern tok::FunctionEntry registered[tok::MAX_FUNCTIONS - tok::BUILTIN_COUNT];
+    extern std::atomic<unsigned> registeredCount;
+    /**
+     * The function with the given index. Entries never change once they are
+     * registered, so this is safe while others register functions.
+     **/
+    inline const tok::FunctionEntry &function(unsigned index)
+    {
+        return index < tok::BUILTIN_COUNT ? tok::BUILTINS[index] : tok::registered[index - tok::BUILTIN_COUNT];
+    }
+    /**
+     * The index of the function with the given name, or -1.
+     **/
+    int findFunction(std::string_view name);
+    /**
+     * The number of CALL instructions that apply the function to the given
+     * number of arguments, more than one for the extra arguments of a
+     * variadic function. Throws std::invalid_argument if it does not take
+     * that many, citing the position of the call.
+     **/
+    unsigned calls(unsigned index, unsigned arguments, unsigned position);
+    /**
+     * Make a function callable from every expression compiled afterwards and
+     * return its index. Throws std::invalid_argument if the name is taken,
+     * the arity is too large or there is no room for another function.
+     **/
+    unsigned registerFunction(std::string_view name, unsigned arity, tok::ScalarFunction scalar,
+                              tok::BatchFunction batch = nullptr, bool pure = true);
+}
+
+#endif
@@ -0,0 +1,426 @@
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+#include "Jit.hpp"
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define TOK_JIT 1
+#endif
+
+void tok::JitState::compile(const tok::CompiledExpression &program)
+{
+    this->owned = tok::jit(program);
+    if (this->owned)
+        this->code.store(this->owned.get(), std::memory_order_release);
+}
+#ifdef TOK_JIT
+namespace
+{
+    enum REGISTER
+    {
+        RAX = 0,
+        RCX = 1,
+        RDX = 2,
+        RSI = 6,
+        RDI = 7,
+        R8 = 8,
+        R9 = 9,
+        R10 = 10
+    };
+    // The stack values live in xmm0 to xmm12, the rest is scratch.
+    const int STACK_REGISTERS = 13;
+    const int SCRATCH1 = 13;
+    const int SCRATCH2 = 14;
+    const int SCRATCH3 = 15;
+    const std::uint64_t SIGN_BIT = 0x8000000000000000ull;
+    const std::uint64_t ONE = 0x3FF0000000000000ull;
+    /**
+     * Just enough of an x86-64 encoder for the instructions the programs need.
+     * Register numbers are 0-15 for both the general purpose and xmm registers.
+     **/
+    struct Assembler
+    {
+        std::vector<std::uint8_t> code;
+
+        void bytes(std::initializer_list<std::uint8_t> list)
+        {
+            this->code.insert(this->code.end(), list.begin(), list.end());
+        }
+        void int32(std::int32_t value)
+        {
+            std::uint8_t raw[4];
+            std::memcpy(raw, &value, 4);
+            this->code.insert(this->code.end(), raw, raw + 4);
+        }
+        void int64(std::uint64_t value)
+        {
+            std::uint8_t raw[8];
+            std::memcpy(raw, &value, 8);
+            this->code.insert(this->code.end(), raw, raw + 8);
+        }
+        void prefix(std::uint8_t prefix, int reg, int index, int base, bool wide)
+        {
+            if (prefix)
+                this->code.push_back(prefix);
+            std::uint8_t rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+            if (rex != 0x40)
+                this->code.push_back(rex);
+            this->code.push_back(0x0F);
+        }
+        // op reg, rm with both operands in registers.
+        void sse(std::uint8_t prefix, std::uint8_t opcode, int reg, int rm, bool wide = false)
+        {
+            this->prefix(prefix, reg, 0, rm, wide);
+            this->bytes({opcode, (std::uint8_t)(0xC0 | ((reg & 7) << 3) | (rm & 7))});
+        }
+        // op reg, [base + displacement]
+        void sseMemory(std::uint8_t prefix, std::uint8_t opcode, int reg, int base, std::int32_t displacement)
+        {
+            this->prefix(prefix, reg, 0, base, false);
+            this->bytes({opcode, (std::uint8_t)(0x80 | ((reg & 7) << 3) | (base & 7))});
+            this->int32(displacement);
+        }
+        // op reg, [base + index * 8]
+        void sseIndexed(std::uint8_t prefix, std::uint8_t opcode, int reg, int base, int index)
+        {
+            this->prefix(prefix, reg, index, base, false);
+            this->bytes({opcode, (std::uint8_t)(((reg & 7) << 3) | 4), (std::uint8_t)(0xC0 | ((index & 7) << 3) | (base & 7))});
+        }
+        // mov rax, imm64
+        void loadRax(std::uint64_t value)
+        {
+            this->bytes({0x48, 0xB8});
+            this->int64(value);
+        }
+        // movq xmm, rax
+        void movqFromRax(int xmm)
+        {
+            this->sse(0x66, 0x6E, xmm, RAX, true);
+        }
+        // Emit a jump with an open 32 bit offset and return where to patch it.
+        std::size_t jump(std::initializer_list<std::uint8_t> opcode)
+        {
+            this->bytes(opcode);
+            this->int32(0);
+            return this->code.size() - 4;
+        }
+        // Let the jump at the given offset land on the current position.
+        void land(std::size_t at)
+        {
+            std::int32_t relative = this->code.size() - (at + 4);
+            std::memcpy(&this->code[at], &relative, 4);
+        }
+    };
+    // Both integer operands: eax = (int)operand1, ecx = (int)operand2
+    void truncate(Assembler &a, int operand1, int operand2)
+    {
+        a.sse(0xF2, 0x2C, RAX, operand1);
+        a.sse(0xF2, 0x2C, RCX, operand2);
+    }
+    // operand = (double)eax, without depending on the old value of operand.
+    void convert(Assembler &a, int operand)
+    {
+        a.sse(0x66, 0x57, operand, operand);
+        a.sse(0xF2, 0x2A, operand, RAX);
+    }
+    // The integer type packed into the register: operand = tok::pack(tok::integer(operand)),
+    // the 64 bit cvttsd2si gives INT64_MIN for whatever does not fit as well.
+    void toInteger(Assembler &a, int operand)
+    {
+        a.sse(0xF2, 0x2C, RAX, operand, true);
+        a.movqFromRax(operand);
+    }
+    // operand = (double)tok::unpack(operand)
+    void toReal(Assembler &a, int operand)
+    {
+        a.sse(0x66, 0x7E, operand, RAX, true); // movq rax, operand
+        a.sse(0x66, 0x57, operand, operand);
+        a.sse(0xF2, 0x2A, operand, RAX, true);
+    }
+    /**
+     * double f(const double *bindings, const double *constants, double *temporaries, double *outputs)
+     * with the bindings in rdi, the constants in rsi, the temporaries moved to r8
+     * and the outputs to r9.
+     * Values of the integer type stay packed in their registers.
+     **/
+    bool scalar(Assembler &a, const tok::CompiledExpression &compiled)
+    {
+        const std::vector<tok::Instruction> &program = compiled.getProgram();
+        const std::vector<tok::Typing> &typing = compiled.getTyping();
+        // mov r8, rdx; mov r9, rcx
+        a.bytes({0x49, 0x89, 0xD0, 0x49, 0x89, 0xC9});
+        int depth = 0;
+        for (std::size_t i = 0; i < program.size(); i++)
+        {
+            const tok::Instruction &ins = program[i];
+            int top = depth - 1;
+            int operand1 = depth - 2;
+            switch (ins.op)
+            {
+            case tok::OPCODE::CONST:
+                if (typing[i].type == tok::TYPE::INTEGER)
+                {
+                    a.loadRax(tok::integer(compiled.getConstants()[ins.arg]));
+                    a.movqFromRax(depth);
+                }
+                else
+                {
+                    a.sseMemory(0xF2, 0x10, depth, RSI, 8 * ins.arg);
+                }
+                break;
+            case tok::OPCODE::LOAD:
+                a.sseMemory(0xF2, 0x10, depth, RDI, 8 * ins.arg);
+                if (typing[i].type == tok::TYPE::INTEGER)
+                    toInteger(a, depth);
+                break;
+            case tok::OPCODE::RECALL:
+                a.sseMemory(0xF2, 0x10, depth, R8, 8 * ins.arg);
+                break;
+            case tok::OPCODE::STORE:
+                a.sseMemory(0xF2, 0x11, top, R8, 8 * ins.arg);
+                break;
+            case tok::OPCODE::YIELD:
+                a.sseMemory(0xF2, 0x11, top, R9, 8 * ins.arg);
+                break;
+            case tok::OPCODE::DROP:
+                a.sse(0x66, 0x28, operand1, top); // movapd
+                break;
+            case tok::OPCODE::PLUS:
+                break;
+            case tok::OPCODE::NEG:
+                a.loadRax(SIGN_BIT);
+                a.movqFromRax(SCRATCH3);
+                a.sse(0x66, 0x57, top, SCRATCH3);
+                break;
+            case tok::OPCODE::LNOT:
+                // (0 == x) & 1.0
+                a.sse(0x66, 0x57, SCRATCH3, SCRATCH3);
+                a.sse(0xF2, 0xC2, SCRATCH3, top);
+                a.bytes({0x00});
+                a.loadRax(ONE);
+                a.movqFromRax(SCRATCH2);
+                a.sse(0x66, 0x54, SCRATCH3, SCRATCH2);
+                a.sse(0x66, 0x28, top, SCRATCH3);
+                break;
+            case tok::OPCODE::ADD:
+                a.sse(0xF2, 0x58, operand1, top);
+                break;
+            case tok::OPCODE::SUB:
+                a.sse(0xF2, 0x5C, operand1, top);
+                break;
+            case tok::OPCODE::MUL:
+                a.sse(0xF2, 0x59, operand1, top);
+                break;
+            case tok::OPCODE::DIV:
+                a.sse(0xF2, 0x5E, operand1, top);
+                break;
+            // The integer operators find their operands packed already.
+            case tok::OPCODE::BAND:
+                a.sse(0x66, 0x54, operand1, top); // andpd
+                break;
+            case tok::OPCODE::BOR:
+                a.sse(0x66, 0x56, operand1, top); // orpd
+                break;
+            case tok::OPCODE::LAND:
+            case tok::OPCODE::LOR:
+                truncate(a, operand1, top);
+                a.bytes({0x85, 0xC0, 0x0F, 0x95, 0xC0}); // test eax, eax; setne al
+                a.bytes({0x85, 0xC9, 0x0F, 0x95, 0xC1}); // test ecx, ecx; setne cl
+                if (ins.op == tok::OPCODE::LAND)
+                    a.bytes({0x20, 0xC8}); // and al, cl
+                else
+                    a.bytes({0x08, 0xC8}); // or al, cl
+                a.bytes({0x0F, 0xB6, 0xC0}); // movzx eax, al
+                convert(a, operand1);
+                break;
+            case tok::OPCODE::MOD:
+            {
+                // The same cases as tok::remainder: NaN for 0, 0 for -1, idiv otherwise.
+                a.sse(0x66, 0x7E, operand1, RAX, true); // movq rax, operand1
+                a.sse(0x66, 0x7E, top, RCX, true);      // movq rcx, top
+                a.bytes({0x48, 0x85, 0xC9});            // test rcx, rcx
+                std::size_t zero = a.jump({0x0F, 0x84});
+                a.bytes({0x48, 0x83, 0xF9, 0xFF}); // cmp rcx, -1
+                std::size_t minusOne = a.jump({0x0F, 0x84});
+                a.bytes({0x48, 0x99, 0x48, 0xF7, 0xF9, 0x48, 0x89, 0xD0}); // cqo; idiv rcx; mov rax, rdx
+                if (typing[i].type == tok::TYPE::INTEGER)
+                {
+                    a.movqFromRax(operand1);
+                }
+                else
+                {
+                    a.sse(0x66, 0x57, operand1, operand1);
+                    a.sse(0xF2, 0x2A, operand1, RAX, true);
+                }
+                std::size_t done = a.jump({0xE9});
+                a.land(minusOne);
+                a.sse(0x66, 0x57, operand1, operand1);
+                std::size_t done2 = a.jump({0xE9});
+                a.land(zero);
+                a.loadRax(0x7FF8000000000000ull);
+                a.movqFromRax(operand1);
+                a.land(done);
+                a.land(done2);
+                break;
+            }
+            default:
+                return false;
+            }
+            depth = depth - tok::operands(ins.op) + 1;
+            if (typing[i].type != typing[i].consumed && typing[i].consumed == tok::TYPE::INTEGER)
+                toInteger(a, depth - 1);
+            else if (typing[i].type != typing[i].consumed)
+                toReal(a, depth - 1);
+        }
+        a.bytes({0xC3});
+        return true;
+    }
+    /**
+     * void f(const double *const *columns, std::size_t rows, double *out, const double *constants, double *temporaries)
+     * Runs the program over two rows per iteration with packed SSE2 operations.
+     * The row index lives in rcx, the constants in r9 and out in r10.
+     **/
+    bool block(Assembler &a, const std::vector<tok::Instruction> &program)
+    {
+        a.bytes({0x49, 0x89, 0xC9}); // mov r9, rcx
+        a.bytes({0x49, 0x89, 0xD2}); // mov r10, rdx
+        a.bytes({0x31, 0xC9});       // xor ecx, ecx
+        std::size_t loop = a.code.size();
+        a.bytes({0x48, 0x39, 0xF1}); // cmp rcx, rsi
+        std::size_t end = a.jump({0x0F, 0x83});
+        int depth = 0;
+        for (const tok::Instruction &ins : program)
+        {
+            int top = depth - 1;
+            int operand1 = depth - 2;
+            switch (ins.op)
+            {
+            case tok::OPCODE::CONST:
+                a.sseMemory(0xF2, 0x10, depth, R9, 8 * ins.arg);
+                a.sse(0x66, 0x14, depth, depth); // unpcklpd
+                break;
+            case tok::OPCODE::LOAD:
+                a.bytes({0x48, 0x8B, 0x87}); // mov rax, [rdi + 8 * slot]
+                a.int32(8 * ins.arg);
+                a.sseIndexed(0x66, 0x10, depth, RAX, RCX);
+                break;
+            case tok::OPCODE::RECALL:
+                a.sseMemory(0x66, 0x10, depth, R8, 16 * ins.arg);
+                break;
+            case tok::OPCODE::STORE:
+                a.sseMemory(0x66, 0x11, top, R8, 16 * ins.arg);
+                break;
+            case tok::OPCODE::PLUS:
+                break;
+            case tok::OPCODE::NEG:
+                a.loadRax(SIGN_BIT);
+                a.movqFromRax(SCRATCH3);
+                a.sse(0x66, 0x14, SCRATCH3, SCRATCH3);
+                a.sse(0x66, 0x57, top, SCRATCH3);
+                break;
+            case tok::OPCODE::LNOT:
+                a.sse(0x66, 0x57, SCRATCH3, SCRATCH3);
+                a.sse(0x66, 0xC2, SCRATCH3, top);
+                a.bytes({0x00});
+                a.loadRax(ONE);
+                a.movqFromRax(SCRATCH2);
+                a.sse(0x66, 0x14, SCRATCH2, SCRATCH2);
+                a.sse(0x66, 0x54, SCRATCH3, SCRATCH2);
+                a.sse(0x66, 0x28, top, SCRATCH3);
+                break;
+            case tok::OPCODE::ADD:
+                a.sse(0x66, 0x58, operand1, top);
+                break;
+            case tok::OPCODE::SUB:
+                a.sse(0x66, 0x5C, operand1, top);
+                break;
+            case tok::OPCODE::MUL:
+                a.sse(0x66, 0x59, operand1, top);
+                break;
+            case tok::OPCODE::DIV:
+                a.sse(0x66, 0x5E, operand1, top);
+                break;
+            case tok::OPCODE::LAND:
+            case tok::OPCODE::LOR:
+                a.sse(0x66, 0xE6, SCRATCH2, operand1);
+                a.sse(0x66, 0xE6, SCRATCH3, top);
+                a.sse(0x66, 0xEF, SCRATCH1, SCRATCH1); // pxor
+                a.sse(0x66, 0x76, SCRATCH2, SCRATCH1); // pcmpeqd: operand is zero
+                a.sse(0x66, 0x76, SCRATCH3, SCRATCH1);
+                a.sse(0x66, ins.op == tok::OPCODE::LAND ? 0xEB : 0xDB, SCRATCH2, SCRATCH3);
+                a.bytes({0xB8, 0x01, 0x00, 0x00, 0x00}); // mov eax, 1
+                a.sse(0x66, 0x6E, SCRATCH1, RAX);        // movd
+                a.sse(0x66, 0x70, SCRATCH1, SCRATCH1);   // pshufd
+                a.bytes({0x00});
+                a.sse(0x66, 0xDF, SCRATCH2, SCRATCH1); // pandn
+                a.sse(0xF3, 0xE6, operand1, SCRATCH2);
+                break;
+            default:
+                // The modulo has no packed integer division to build on, and
+                // there is no packed conversion to the 64 bit integers the
+                // bitwise operators take before AVX-512DQ. Programs yielding
+                // several values are left to the interpreter as well.
+                return false;
+            }
+            depth = depth - tok::operands(ins.op) + 1;
+        }
+        a.sseIndexed(0x66, 0x11, 0, R10, RCX); // movupd [r10 + rcx * 8], xmm0
+        a.bytes({0x48, 0x83, 0xC1, 0x02});     // add rcx, 2
+        std::size_t back = a.jump({0xE9});
+        std::int32_t relative = loop - (back + 4);
+        std::memcpy(&a.code[back], &relative, 4);
+        a.land(end);
+        a.bytes({0xC3});
+        return true;
+    }
+}
+tok::JitCode::~JitCode()
+{
+    munmap(this->memory, this->length);
+}
+bool tok::jitSupported()
+{
+    return true;
+}
+std::unique_ptr<tok::JitCode> tok::jit(const tok::CompiledExpression &program)
+{
+    // Every value of the stack needs a register of its own, and all
+    // displacements have to fit into 32 bits.
+    if (program.getMaxDepth() > STACK_REGISTERS || program.getConstants().size() > (1u << 24) ||
+        program.getSymbols().size() > (1u << 24) || program.getTemporaries() > (1u << 24) || program.getOutputs() > (1u << 24))
+        return nullptr;
+    Assembler scalarCode, blockCode;
+    if (!scalar(scalarCode, program))
+        return nullptr;
+    bool hasBlock = block(blockCode, program.getProgram());
+    // The block function starts on the next cache line behind the scalar one.
+    std::size_t offset = (scalarCode.code.size() + 63) & ~(std::size_t)63;
+    std::size_t length = offset + (hasBlock ? blockCode.code.size() : 0);
+    void *memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+        return nullptr;
+    std::memcpy(memory, scalarCode.code.data(), scalarCode.code.size());
+    if (hasBlock)
+        std::memcpy((char *)memory + offset, blockCode.code.data(), blockCode.code.size());
+    // Never writable and executable at the same time:
+    if (mprotect(memory, length, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, length);
+        return nullptr;
+    }
+    return std::unique_ptr<tok::JitCode>(new tok::JitCode(memory, length, (tok::JitFunction)memory,
+                                                          hasBlock ? (tok::JitBlockFunction)((char *)memory + offset) : nullptr));
+}
+#else
+tok::JitCode::~JitCode()
+{
+}
+bool tok::jitSupported()
+{
+    return false;
+}
+std::unique_ptr<tok::JitCode> tok::jit(const tok::CompiledExpression &)
+{
+    return nullptr;
+}
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+#ifndef JIT_H
+#define JIT_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "Program.hpp"
+
+namespace tok
+{
+    // Evaluates one row: bindings, constant pool, room for the temporaries
+    // and for the values the program yields.
+    typedef double (*JitFunction)(const double *bindings, const double *constants, double *temporaries, double *outputs);
+    // Evaluates an even number of rows, two per SSE2 register. The temporaries
+    // need room for two values each.
+    typedef void (*JitBlockFunction)(const double *const *columns, std::size_t rows, double *out, const double *constants, double *temporaries);
+    /**
+     * Native x86-64 code generated for one program, living in its own
+     * executable mapping that is unmapped again with the object.
+     **/
+    struct JitCode
+    {
+    private:
+        void *memory;
+        std::size_t length;
+
+    public:
+        JitFunction scalar;
+        // Null if the program uses an operation the block loop has no code for.
+        JitBlockFunction block;
+
+        JitCode(void *memory, std::size_t length, JitFunction scalar, JitBlockFunction block)
+            : memory(memory), length(length), scalar(scalar), block(block)
+        {
+        }
+        JitCode(const JitCode &) = delete;
+        JitCode &operator=(const JitCode &) = delete;
+        ~JitCode();
+    };
+    /**
+     * Counts the evaluations of a program and compiles it to native code once
+     * the count crosses the threshold. Until the code is published, and for
+     * good if the program cannot be compiled, the interpreter keeps running.
+     **/
+    struct JitState
+    {
+    private:
+        std::atomic<std::uint64_t> runs{0};
+        std::uint64_t threshold;
+        std::atomic<const tok::JitCode *> code{nullptr};
+        std::unique_ptr<tok::JitCode> owned;
+
+    public:
+        explicit JitState(std::uint64_t threshold) : threshold(threshold)
+        {
+        }
+        inline const tok::JitCode *getCode() const
+        {
+            return this->code.load(std::memory_order_acquire);
+        }
+        /**
+         * Record n more evaluations of the program. The one call that crosses
+         * the threshold compiles it.
+         **/
+        inline void count(const tok::CompiledExpression &program, std::uint64_t n)
+        {
+            if (this->runs.load(std::memory_order_relaxed) >= this->threshold)
+                return;
+            std::uint64_t before = this->runs.fetch_add(n, std::memory_order_relaxed);
+            if (before < this->threshold && before + n >= this->threshold)
+                this->compile(program);
+        }
+        void compile(const tok::CompiledExpression &program);
+    };
+    /**
+     * Whether native code can be generated on this platform at all.
+     **/
+    bool jitSupported();
+    /**
+     * Generate native code for the program, or return null if the platform or
+     * one of its operations is not supported.
+     **/
+    std::unique_ptr<tok::JitCode> jit(const tok::CompiledExpression &program);
+}
+
+#endif
@@ -0,0 +1,426 @@
+#include "Kernels.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOK_X86 1
+#endif
+// The scalar kernels define the semantics all other variants are checked against.
+namespace
+{
+    void scalarNeg(double *operands, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; i++)
+            operands[i] = -operands[i];
+    }
+    void scalarLnot(double *operands, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; i++)
+            operands[i] = tok::lnot(operands[i]);
+    }
+#define TOK_SCALAR_KERNEL(NAME, EXPR)                                      \
+    void NAME(double *operands1, const double *operands2, std::size_t n) \
+    {                                                                    \
+        for (std::size_t i = 0; i < n; i++)                              \
+        {                                                                \
+            double a = operands1[i], b = operands2[i];                   \
+            operands1[i] = EXPR;                                         \
+        }                                                                \
+    }
+    TOK_SCALAR_KERNEL(scalarAdd, a + b)
+    TOK_SCALAR_KERNEL(scalarSub, a - b)
+    TOK_SCALAR_KERNEL(scalarMul, a * b)
+    TOK_SCALAR_KERNEL(scalarDiv, a / b)
+    TOK_SCALAR_KERNEL(scalarLand, tok::land(a, b))
+    TOK_SCALAR_KERNEL(scalarLor, tok::lor(a, b))
+#define TOK_INTEGER_KERNEL(NAME, EXPR)                                     \
+    void NAME(double *operands1, const double *operands2, std::size_t n) \
+    {                                                                    \
+        for (std::size_t i = 0; i < n; i++)                              \
+        {                                                                \
+            std::int64_t a = tok::unpack(operands1[i]);                  \
+            std::int64_t b = tok::unpack(operands2[i]);                  \
+            operands1[i] = tok::pack(EXPR);                              \
+        }                                                                \
+    }
+    TOK_INTEGER_KERNEL(integerMod, tok::mod(a, b))
+    TOK_INTEGER_KERNEL(scalarBand, a & b)
+    TOK_INTEGER_KERNEL(scalarBor, a | b)
+    void scalarToInteger(double *operands, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; i++)
+            operands[i] = tok::pack(tok::integer(operands[i]));
+    }
+    void scalarToReal(double *operands, std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; i++)
+            operands[i] = (double)tok::unpack(operands[i]);
+    }
+
+    const tok::Kernels SCALAR{"scalar", scalarNeg, scalarLnot, scalarAdd, scalarSub, scalarMul, scalarDiv,
+                              integerMod, scalarBand, scalarBor, scalarLand, scalarLor, scalarToInteger, scalarToReal};
+}
+#ifdef TOK_X86
+/**
+ * The vector kernels process as many full registers as fit into the block and
+ * hand the remaining rows to the scalar kernel. The logical operators convert
+ * with truncation (cvttpd2dq), which is what the (int) cast compiles to, so the
+ * out of range results match the scalar path as well. The bitwise operators
+ * get their integers packed already, the bits of a double are the same.
+ * Without AVX-512DQ there is no packed conversion between doubles and 64 bit
+ * integers, so the conversions and the remainder go through int32 where all
+ * lanes of a register fit, which is exact, and the scalar way otherwise.
+ **/
+namespace
+{
+    // SSE2: two rows per register.
+    __attribute__((target("sse2"))) void sse2Neg(double *operands, std::size_t n)
+    {
+        const __m128d sign = _mm_set1_pd(-0.0);
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2)
+            _mm_storeu_pd(operands + i, _mm_xor_pd(_mm_loadu_pd(operands + i), sign));
+        scalarNeg(operands + i, n - i);
+    }
+    __attribute__((target("sse2"))) void sse2Lnot(double *operands, std::size_t n)
+    {
+        const __m128d one = _mm_set1_pd(1.0);
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2)
+            _mm_storeu_pd(operands + i, _mm_and_pd(_mm_cmpeq_pd(_mm_loadu_pd(operands + i), _mm_setzero_pd()), one));
+        scalarLnot(operands + i, n - i);
+    }
+#define TOK_SSE2_KERNEL(NAME, SCALAR, INTRINSIC)                                                     \
+    __attribute__((target("sse2"))) void NAME(double *operands1, const double *operands2, std::size_t n) \
+    {                                                                                                \
+        std::size_t i = 0;                                                                           \
+        for (; i + 2 <= n; i += 2)                                                                   \
+            _mm_storeu_pd(operands1 + i, INTRINSIC(_mm_loadu_pd(operands1 + i), _mm_loadu_pd(operands2 + i))); \
+        SCALAR(operands1 + i, operands2 + i, n - i);                                                 \
+    }
+    TOK_SSE2_KERNEL(sse2Add, scalarAdd, _mm_add_pd)
+    TOK_SSE2_KERNEL(sse2Sub, scalarSub, _mm_sub_pd)
+    TOK_SSE2_KERNEL(sse2Mul, scalarMul, _mm_mul_pd)
+    TOK_SSE2_KERNEL(sse2Div, scalarDiv, _mm_div_pd)
+    TOK_SSE2_KERNEL(sse2Band, scalarBand, _mm_and_pd)
+    TOK_SSE2_KERNEL(sse2Bor, scalarBor, _mm_or_pd)
+
+    __attribute__((target("sse2"))) inline __m128d sse2Land(__m128d a, __m128d b)
+    {
+        __m128i zeroA = _mm_cmpeq_epi32(_mm_cvttpd_epi32(a), _mm_setzero_si128());
+        __m128i zeroB = _mm_cmpeq_epi32(_mm_cvttpd_epi32(b), _mm_setzero_si128());
+        return _mm_cvtepi32_pd(_mm_andnot_si128(_mm_or_si128(zeroA, zeroB), _mm_set1_epi32(1)));
+    }
+    __attribute__((target("sse2"))) inline __m128d sse2Lor(__m128d a, __m128d b)
+    {
+        __m128i zeroA = _mm_cmpeq_epi32(_mm_cvttpd_epi32(a), _mm_setzero_si128());
+        __m128i zeroB = _mm_cmpeq_epi32(_mm_cvttpd_epi32(b), _mm_setzero_si128());
+        return _mm_cvtepi32_pd(_mm_andnot_si128(_mm_and_si128(zeroA, zeroB), _mm_set1_epi32(1)));
+    }
+    TOK_SSE2_KERNEL(sse2LandKernel, scalarLand, sse2Land)
+    TOK_SSE2_KERNEL(sse2LorKernel, scalarLor, sse2Lor)
+
+    // The int32 in the low halves of the two integers, if that is what they are.
+    __attribute__((target("sse2"))) inline bool sse2Narrow(__m128i integers, __m128i &lows)
+    {
+        lows = _mm_shuffle_epi32(integers, _MM_SHUFFLE(2, 0, 2, 0));
+        return _mm_movemask_epi8(_mm_cmpeq_epi32(_mm_unpacklo_epi32(lows, _mm_srai_epi32(lows, 31)), integers)) == 0xFFFF;
+    }
+    __attribute__((target("sse2"))) void sse2ToInteger(double *operands, std::size_t n)
+    {
+        const __m128d low = _mm_set1_pd(-2147483649.0);
+        const __m128d high = _mm_set1_pd(2147483648.0);
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2)
+        {
+            __m128d x = _mm_loadu_pd(operands + i);
+            if (_mm_movemask_pd(_mm_and_pd(_mm_cmpgt_pd(x, low), _mm_cmplt_pd(x, high))) != 3)
+            {
+                scalarToInteger(operands + i, 2);
+                continue;
+            }
+            __m128i lows = _mm_cvttpd_epi32(x);
+            _mm_storeu_si128((__m128i *)(operands + i), _mm_unpacklo_epi32(lows, _mm_srai_epi32(lows, 31)));
+        }
+        scalarToInteger(operands + i, n - i);
+    }
+    __attribute__((target("sse2"))) void sse2ToReal(double *operands, std::size_t n)
+    {
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2)
+        {
+            __m128i lows;
+            if (sse2Narrow(_mm_loadu_si128((const __m128i *)(operands + i)), lows))
+                _mm_storeu_pd(operands + i, _mm_cvtepi32_pd(lows));
+            else
+                scalarToReal(operands + i, 2);
+        }
+        scalarToReal(operands + i, n - i);
+    }
+    __attribute__((target("sse2"))) void sse2Mod(double *operands1, const double *operands2, std::size_t n)
+    {
+        std::size_t i = 0;
+        for (; i + 2 <= n; i += 2)
+        {
+            __m128i a, b;
+            if (!sse2Narrow(_mm_loadu_si128((const __m128i *)(operands1 + i)), a) ||
+                !sse2Narrow(_mm_loadu_si128((const __m128i *)(operands2 + i)), b))
+            {
+                integerMod(operands1 + i, operands2 + i, 2);
+                continue;
+            }
+            __m128d dividend = _mm_cvtepi32_pd(a);
+            __m128d divisor = _mm_cvtepi32_pd(b);
+            // The quotient of two int32 is exact after truncating the double division.
+            __m128d quotient = _mm_cvtepi32_pd(_mm_cvttpd_epi32(_mm_div_pd(dividend, divisor)));
+            __m128d rest = _mm_sub_pd(dividend, _mm_mul_pd(quotient, divisor));
+            __m128i lows = _mm_cvttpd_epi32(_mm_andnot_pd(_mm_cmpeq_pd(divisor, _mm_set1_pd(-1.0)), rest));
+            _mm_storeu_si128((__m128i *)(operands1 + i), _mm_unpacklo_epi32(lows, _mm_srai_epi32(lows, 31)));
+        }
+        integerMod(operands1 + i, operands2 + i, n - i);
+    }
+
+    const tok::Kernels SSE2{"sse2", sse2Neg, sse2Lnot, sse2Add, sse2Sub, sse2Mul, sse2Div,
+                            sse2Mod, sse2Band, sse2Bor, sse2LandKernel, sse2LorKernel, sse2ToInteger, sse2ToReal};
+
+    // AVX2: four rows per register, the integer halves stay in SSE registers.
+    __attribute__((target("avx2"))) void avx2Neg(double *operands, std::size_t n)
+    {
+        const __m256d sign = _mm256_set1_pd(-0.0);
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm256_storeu_pd(operands + i, _mm256_xor_pd(_mm256_loadu_pd(operands + i), sign));
+        scalarNeg(operands + i, n - i);
+    }
+    __attribute__((target("avx2"))) void avx2Lnot(double *operands, std::size_t n)
+    {
+        const __m256d one = _mm256_set1_pd(1.0);
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm256_storeu_pd(operands + i, _mm256_and_pd(_mm256_cmp_pd(_mm256_loadu_pd(operands + i), _mm256_setzero_pd(), _CMP_EQ_OQ), one));
+        scalarLnot(operands + i, n - i);
+    }
+#define TOK_AVX2_KERNEL(NAME, SCALAR, INTRINSIC)                                                     \
+    __attribute__((target("avx2"))) void NAME(double *operands1, const double *operands2, std::size_t n) \
+    {                                                                                                \
+        std::size_t i = 0;                                                                           \
+        for (; i + 4 <= n; i += 4)                                                                   \
+            _mm256_storeu_pd(operands1 + i, INTRINSIC(_mm256_loadu_pd(operands1 + i), _mm256_loadu_pd(operands2 + i))); \
+        SCALAR(operands1 + i, operands2 + i, n - i);                                                 \
+    }
+    TOK_AVX2_KERNEL(avx2Add, scalarAdd, _mm256_add_pd)
+    TOK_AVX2_KERNEL(avx2Sub, scalarSub, _mm256_sub_pd)
+    TOK_AVX2_KERNEL(avx2Mul, scalarMul, _mm256_mul_pd)
+    TOK_AVX2_KERNEL(avx2Div, scalarDiv, _mm256_div_pd)
+    TOK_AVX2_KERNEL(avx2Band, scalarBand, _mm256_and_pd)
+    TOK_AVX2_KERNEL(avx2Bor, scalarBor, _mm256_or_pd)
+
+    __attribute__((target("avx2"))) inline __m256d avx2Land(__m256d a, __m256d b)
+    {
+        __m128i zeroA = _mm_cmpeq_epi32(_mm256_cvttpd_epi32(a), _mm_setzero_si128());
+        __m128i zeroB = _mm_cmpeq_epi32(_mm256_cvttpd_epi32(b), _mm_setzero_si128());
+        return _mm256_cvtepi32_pd(_mm_andnot_si128(_mm_or_si128(zeroA, zeroB), _mm_set1_epi32(1)));
+    }
+    __attribute__((target("avx2"))) inline __m256d avx2Lor(__m256d a, __m256d b)
+    {
+        __m128i zeroA = _mm_cmpeq_epi32(_mm256_cvttpd_epi32(a), _mm_setzero_si128());
+        __m128i zeroB = _mm_cmpeq_epi32(_mm256_cvttpd_epi32(b), _mm_setzero_si128());
+        return _mm256_cvtepi32_pd(_mm_andnot_si128(_mm_and_si128(zeroA, zeroB), _mm_set1_epi32(1)));
+    }
+    TOK_AVX2_KERNEL(avx2LandKernel, scalarLand, avx2Land)
+    TOK_AVX2_KERNEL(avx2LorKernel, scalarLor, avx2Lor)
+
+    __attribute__((target("avx2"))) inline bool avx2Narrow(__m256i integers, __m128i &lows)
+    {
+        lows = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(integers, _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6)));
+        return _mm256_movemask_epi8(_mm256_cmpeq_epi64(_mm256_cvtepi32_epi64(lows), integers)) == -1;
+    }
+    __attribute__((target("avx2"))) void avx2ToInteger(double *operands, std::size_t n)
+    {
+        const __m256d low = _mm256_set1_pd(-2147483649.0);
+        const __m256d high = _mm256_set1_pd(2147483648.0);
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m256d x = _mm256_loadu_pd(operands + i);
+            if (_mm256_movemask_pd(_mm256_and_pd(_mm256_cmp_pd(x, low, _CMP_GT_OQ), _mm256_cmp_pd(x, high, _CMP_LT_OQ))) != 15)
+            {
+                scalarToInteger(operands + i, 4);
+                continue;
+            }
+            _mm256_storeu_si256((__m256i *)(operands + i), _mm256_cvtepi32_epi64(_mm256_cvttpd_epi32(x)));
+        }
+        scalarToInteger(operands + i, n - i);
+    }
+    __attribute__((target("avx2"))) void avx2ToReal(double *operands, std::size_t n)
+    {
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128i lows;
+            if (avx2Narrow(_mm256_loadu_si256((const __m256i *)(operands + i)), lows))
+                _mm256_storeu_pd(operands + i, _mm256_cvtepi32_pd(lows));
+            else
+                scalarToReal(operands + i, 4);
+        }
+        scalarToReal(operands + i, n - i);
+    }
+    __attribute__((target("avx2"))) void avx2Mod(double *operands1, const double *operands2, std::size_t n)
+    {
+        std::size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128i a, b;
+            if (!avx2Narrow(_mm256_loadu_si256((const __m256i *)(operands1 + i)), a) ||
+                !avx2Narrow(_mm256_loadu_si256((const __m256i *)(operands2 + i)), b))
+            {
+                integerMod(operands1 + i, operands2 + i, 4);
+                continue;
+            }
+            __m256d dividend = _mm256_cvtepi32_pd(a);
+            __m256d divisor = _mm256_cvtepi32_pd(b);
+            __m256d quotient = _mm256_round_pd(_mm256_div_pd(dividend, divisor), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+            __m256d rest = _mm256_sub_pd(dividend, _mm256_mul_pd(quotient, divisor));
+            rest = _mm256_andnot_pd(_mm256_cmp_pd(divisor, _mm256_set1_pd(-1.0), _CMP_EQ_OQ), rest);
+            _mm256_storeu_si256((__m256i *)(operands1 + i), _mm256_cvtepi32_epi64(_mm256_cvttpd_epi32(rest)));
+        }
+        integerMod(operands1 + i, operands2 + i, n - i);
+    }
+
+    const tok::Kernels AVX2{"avx2", avx2Neg, avx2Lnot, avx2Add, avx2Sub, avx2Mul, avx2Div,
+                            avx2Mod, avx2Band, avx2Bor, avx2LandKernel, avx2LorKernel, avx2ToInteger, avx2ToReal};
+
+    // AVX-512F: eight rows per register. Only the F subset is used, so the
+    // bitwise operations on doubles go through the integer instructions.
+    __attribute__((target("avx512f"))) void avx512Neg(double *operands, std::size_t n)
+    {
+        const __m512i sign = _mm512_castpd_si512(_mm512_set1_pd(-0.0));
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm512_storeu_pd(operands + i, _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(_mm512_loadu_pd(operands + i)), sign)));
+        scalarNeg(operands + i, n - i);
+    }
+    __attribute__((target("avx512f"))) void avx512Lnot(double *operands, std::size_t n)
+    {
+        const __m512d one = _mm512_set1_pd(1.0);
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+            _mm512_storeu_pd(operands + i, _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(_mm512_loadu_pd(operands + i), _mm512_setzero_pd(), _CMP_EQ_OQ), one));
+        scalarLnot(operands + i, n - i);
+    }
+#define TOK_AVX512_KERNEL(NAME, SCALAR, INTRINSIC)                                                     \
+    __attribute__((target("avx512f"))) void NAME(double *operands1, const double *operands2, std::size_t n) \
+    {                                                                                                  \
+        std::size_t i = 0;                                                                             \
+        for (; i + 8 <= n; i += 8)                                                                     \
+            _mm512_storeu_pd(operands1 + i, INTRINSIC(_mm512_loadu_pd(operands1 + i), _mm512_loadu_pd(operands2 + i))); \
+        SCALAR(operands1 + i, operands2 + i, n - i);                                                   \
+    }
+    TOK_AVX512_KERNEL(avx512Add, scalarAdd, _mm512_add_pd)
+    TOK_AVX512_KERNEL(avx512Sub, scalarSub, _mm512_sub_pd)
+    TOK_AVX512_KERNEL(avx512Mul, scalarMul, _mm512_mul_pd)
+    TOK_AVX512_KERNEL(avx512Div, scalarDiv, _mm512_div_pd)
+
+    __attribute__((target("avx512f"))) inline __m512d avx512Band(__m512d a, __m512d b)
+    {
+        return _mm512_castsi512_pd(_mm512_and_si512(_mm512_castpd_si512(a), _mm512_castpd_si512(b)));
+    }
+    __attribute__((target("avx512f"))) inline __m512d avx512Bor(__m512d a, __m512d b)
+    {
+        return _mm512_castsi512_pd(_mm512_or_si512(_mm512_castpd_si512(a), _mm512_castpd_si512(b)));
+    }
+    __attribute__((target("avx512f"))) inline __m512d avx512Land(__m512d a, __m512d b)
+    {
+        __m256i zeroA = _mm256_cmpeq_epi32(_mm512_cvttpd_epi32(a), _mm256_setzero_si256());
+        __m256i zeroB = _mm256_cmpeq_epi32(_mm512_cvttpd_epi32(b), _mm256_setzero_si256());
+        return _mm512_cvtepi32_pd(_mm256_andnot_si256(_mm256_or_si256(zeroA, zeroB), _mm256_set1_epi32(1)));
+    }
+    __attribute__((target("avx512f"))) inline __m512d avx512Lor(__m512d a, __m512d b)
+    {
+        __m256i zeroA = _mm256_cmpeq_epi32(_mm512_cvttpd_epi32(a), _mm256_setzero_si256());
+        __m256i zeroB = _mm256_cmpeq_epi32(_mm512_cvttpd_epi32(b), _mm256_setzero_si256());
+        return _mm512_cvtepi32_pd(_mm256_andnot_si256(_mm256_and_si256(zeroA, zeroB), _mm256_set1_epi32(1)));
+    }
+    TOK_AVX512_KERNEL(avx512BandKernel, scalarBand, avx512Band)
+    TOK_AVX512_KERNEL(avx512BorKernel, scalarBor, avx512Bor)
+    TOK_AVX512_KERNEL(avx512LandKernel, scalarLand, avx512Land)
+    TOK_AVX512_KERNEL(avx512LorKernel, scalarLor, avx512Lor)
+
+    __attribute__((target("avx512f"))) inline bool avx512Narrow(__m512i integers, __m256i &lows)
+    {
+        lows = _mm512_cvtepi64_epi32(integers);
+        return _mm512_cmpeq_epi64_mask(_mm512_cvtepi32_epi64(lows), integers) == 0xFF;
+    }
+    __attribute__((target("avx512f"))) void avx512ToInteger(double *operands, std::size_t n)
+    {
+        const __m512d low = _mm512_set1_pd(-2147483649.0);
+        const __m512d high = _mm512_set1_pd(2147483648.0);
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m512d x = _mm512_loadu_pd(operands + i);
+            if ((_mm512_cmp_pd_mask(x, low, _CMP_GT_OQ) & _mm512_cmp_pd_mask(x, high, _CMP_LT_OQ)) != 0xFF)
+            {
+                scalarToInteger(operands + i, 8);
+                continue;
+            }
+            _mm512_storeu_si512(operands + i, _mm512_cvtepi32_epi64(_mm512_cvttpd_epi32(x)));
+        }
+        scalarToInteger(operands + i, n - i);
+    }
+    __attribute__((target("avx512f"))) void avx512ToReal(double *operands, std::size_t n)
+    {
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256i lows;
+            if (avx512Narrow(_mm512_loadu_si512(operands + i), lows))
+                _mm512_storeu_pd(operands + i, _mm512_cvtepi32_pd(lows));
+            else
+                scalarToReal(operands + i, 8);
+        }
+        scalarToReal(operands + i, n - i);
+    }
+    __attribute__((target("avx512f"))) void avx512Mod(double *operands1, const double *operands2, std::size_t n)
+    {
+        std::size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256i a, b;
+            if (!avx512Narrow(_mm512_loadu_si512(operands1 + i), a) || !avx512Narrow(_mm512_loadu_si512(operands2 + i), b))
+            {
+                integerMod(operands1 + i, operands2 + i, 8);
+                continue;
+            }
+            __m512d dividend = _mm512_cvtepi32_pd(a);
+            __m512d divisor = _mm512_cvtepi32_pd(b);
+            __m512d quotient = _mm512_roundscale_pd(_mm512_div_pd(dividend, divisor), _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+            __m512d rest = _mm512_sub_pd(dividend, _mm512_mul_pd(quotient, divisor));
+            rest = _mm512_mask_mov_pd(rest, _mm512_cmp_pd_mask(divisor, _mm512_set1_pd(-1.0), _CMP_EQ_OQ), _mm512_setzero_pd());
+            _mm512_storeu_si512(operands1 + i, _mm512_cvtepi32_epi64(_mm512_cvttpd_epi32(rest)));
+        }
+        integerMod(operands1 + i, operands2 + i, n - i);
+    }
+
+    const tok::Kernels AVX512{"avx512", avx512Neg, avx512Lnot, avx512Add, avx512Sub, avx512Mul, avx512Div,
+                              avx512Mod, avx512BandKernel, avx512BorKernel, avx512LandKernel, avx512LorKernel,
+                              avx512ToInteger, avx512ToReal};
+}
+#endif
+std::vector<const tok::Kernels *> tok::kernelVariants()
+{
+    std::vector<const tok::Kernels *> variants{&SCALAR};
+#ifdef TOK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        variants.push_back(&SSE2);
+    if (__builtin_cpu_supports("avx2"))
+        variants.push_back(&AVX2);
+    if (__builtin_cpu_supports("avx512f"))
+        variants.push_back(&AVX512);
+#endif
+    return variants;
+}
+const tok::Kernels &tok::kernels()
+{
+    static const tok::Kernels *best = tok::kernelVariants().back();
+    return *best;
+}
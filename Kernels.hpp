@@ -0,0 +1,128 @@
+#pragma once
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace tok
+{
+    /**
+     * The integer an operand of %, & and | stands for: the operand truncated
+     * toward zero, or INT64_MIN if that does not fit (NaN included), which is
+     * also what the truncating conversion of x86 gives.
+     **/
+    inline std::int64_t integer(double operand)
+    {
+        return operand >= -0x1p63 && operand < 0x1p63 ? (std::int64_t)operand : INT64_MIN;
+    }
+    /**
+     * Values of the integer type travel in the 8 bytes of a double, on the
+     * stack and in the temporaries alike.
+     **/
+    inline double pack(std::int64_t value)
+    {
+        double slot;
+        std::memcpy(&slot, &value, sizeof(slot));
+        return slot;
+    }
+    inline std::int64_t unpack(double slot)
+    {
+        std::int64_t value;
+        std::memcpy(&value, &slot, sizeof(value));
+        return value;
+    }
+    // The remainder for every divisor but 0, INT64_MIN % -1 is 0.
+    inline std::int64_t mod(std::int64_t operand1, std::int64_t operand2)
+    {
+        if (operand2 == -1)
+            return 0;
+        // The 32 bit division takes a fraction of the time where it will do.
+        if (operand1 == (std::int32_t)operand1 && operand2 == (std::int32_t)operand2)
+            return (std::int32_t)operand1 % (std::int32_t)operand2;
+        return operand1 % operand2;
+    }
+    // The same as a double, NaN for a divisor of 0 instead of a trap.
+    inline double remainder(std::int64_t operand1, std::int64_t operand2)
+    {
+        if (operand2 == 0)
+            return std::numeric_limits<double>::quiet_NaN();
+        return tok::mod(operand1, operand2);
+    }
+    /**
+     * The scalar semantics of the operators that take integer operands.
+     * Every kernel variant has to produce bit-identical results to these.
+     **/
+    inline double mod(double operand1, double operand2)
+    {
+        return tok::remainder(tok::integer(operand1), tok::integer(operand2));
+    }
+    inline double band(double operand1, double operand2)
+    {
+        return tok::integer(operand1) & tok::integer(operand2);
+    }
+    inline double bor(double operand1, double operand2)
+    {
+        return tok::integer(operand1) | tok::integer(operand2);
+    }
+    // The logical operators still take the truth value of an int.
+    inline double land(double operand1, double operand2)
+    {
+        return (int)operand1 && (int)operand2;
+    }
+    inline double lor(double operand1, double operand2)
+    {
+        return (int)operand1 || (int)operand2;
+    }
+    inline double lnot(double operand)
+    {
+        return !operand;
+    }
+    // The truth value &&, || and ?: take from an operand.
+    inline bool isTrue(double operand)
+    {
+        return (int)operand != 0;
+    }
+    // operands[i] = op(operands[i]) for every i < n
+    typedef void (*UnaryKernel)(double *operands, std::size_t n);
+    // operands1[i] = operands1[i] op operands2[i] for every i < n
+    typedef void (*BinaryKernel)(double *operands1, const double *operands2, std::size_t n);
+    // The same for operands of the integer type, packed into the doubles.
+    typedef BinaryKernel IntegerKernel;
+    /**
+     * One implementation of every block operator, written for a particular
+     * instruction set.
+     **/
+    struct Kernels
+    {
+        const char *name;
+        UnaryKernel neg;
+        UnaryKernel lnot;
+        BinaryKernel add;
+        BinaryKernel sub;
+        BinaryKernel mul;
+        BinaryKernel div;
+        // The remainder for divisors that are not 0.
+        IntegerKernel mod;
+        IntegerKernel band;
+        IntegerKernel bor;
+        BinaryKernel land;
+        BinaryKernel lor;
+        // The conversions between the types, see tok::integer and tok::pack.
+        UnaryKernel toInteger;
+        UnaryKernel toReal;
+    };
+    /**
+     * The fastest kernels the CPU supports, chosen once from cpuid.
+     **/
+    const tok::Kernels &kernels();
+    /**
+     * Every kernel variant the CPU supports, starting with the scalar one.
+     **/
+    std::vector<const tok::Kernels *> kernelVariants();
+}
+
+#endif
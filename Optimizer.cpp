@@ -0,0 +1,333 @@
+#include <cstring>
+#include <unordered_map>
+#include "Optimizer.hpp"
+#include "Functions.hpp"
+#include "Kernels.hpp"
+namespace
+{
+    // Whether the result of the operation on the constants is a double
+    // already, or an integer that converts to one without rounding.
+    bool exact(tok::OPCODE op, double operand1, double operand2)
+    {
+        std::int64_t x = tok::integer(operand1), y = tok::integer(operand2), result;
+        switch (op)
+        {
+        case tok::OPCODE::BAND:
+            result = x & y;
+            break;
+        case tok::OPCODE::BOR:
+            result = x | y;
+            break;
+        case tok::OPCODE::MOD:
+            if (y == 0)
+                return true;
+            result = tok::mod(x, y);
+            break;
+        default:
+            return true;
+        }
+        return tok::integer((double)result) == result;
+    }
+}
+tok::ExpressionGraph::ExpressionGraph(const tok::CompiledExpression &program, const tok::CompileOptions &options) : options(options)
+{
+    this->root = this->lift(program);
+}
+/**
+ * Lift the program into the graph, rewriting every node as soon as its
+ * operands are known. That folds constants bottom up in a single pass.
+ **/
+std::uint32_t tok::ExpressionGraph::lift(const tok::CompiledExpression &program, tok::SymbolTable *symbols)
+{
+    const std::vector<tok::Instruction> &instructions = program.getProgram();
+    std::vector<std::uint32_t> stack;
+    this->nodes.reserve(this->nodes.size() + instructions.size());
+    for (std::size_t i = 0; i < instructions.size(); i++)
+    {
+        tok::Node node{instructions[i].op, instructions[i].arg, 0, 0, 0.0, program.getPosition(i)};
+        node.aux = instructions[i].aux;
+        if (node.op == tok::OPCODE::CONST)
+        {
+            node.value = program.getConstants()[node.arg];
+            node.arg = 0;
+        }
+        else if (node.op == tok::OPCODE::LOAD && symbols)
+        {
+            node.arg = symbols->resolve(program.getSymbols().getName(node.arg));
+        }
+        switch (tok::operands(node))
+        {
+        case 3:
+            node.operand3 = stack.back();
+            stack.pop_back();
+            [[fallthrough]];
+        case 2:
+            node.operand2 = stack.back();
+            stack.pop_back();
+            // Fall through to the leftmost operand:
+            [[fallthrough]];
+        case 1:
+            node.operand1 = stack.back();
+            stack.pop_back();
+            break;
+        }
+        stack.push_back(this->rewrite(node));
+    }
+    return stack.back();
+}
+std::uint32_t tok::ExpressionGraph::add(const tok::Node &node)
+{
+    // Every call of an impure function has to stay a call of its own.
+    bool shared = node.op != tok::OPCODE::CALL || tok::function(node.arg).pure;
+    if (this->options.optimize && this->options.cse && shared)
+    {
+        auto it = this->unique.emplace(tok::key(node), this->nodes.size());
+        if (!it.second)
+        {
+            this->eliminated++;
+            return it.first->second;
+        }
+    }
+    bool pure = node.op != tok::OPCODE::CALL || tok::function(node.arg).pure;
+    std::uint32_t operands[] = {node.operand1, node.operand2, node.operand3};
+    for (int i = 0; i < tok::operands(node); i++)
+        pure = pure && this->pure[operands[i]];
+    this->nodes.push_back(node);
+    this->pure.push_back(pure);
+    return this->nodes.size() - 1;
+}
+std::uint32_t tok::ExpressionGraph::constant(double value, unsigned position)
+{
+    return this->add({tok::OPCODE::CONST, 0, 0, 0, value, position});
+}
+// Compares the bits, so that 0 and -0 are told apart.
+bool tok::ExpressionGraph::isConstant(std::uint32_t node, double value) const
+{
+    const tok::Node &n = this->nodes[node];
+    return n.op == tok::OPCODE::CONST && std::memcmp(&n.value, &value, sizeof(double)) == 0;
+}
+// A boolean node can only ever be 0 or 1.
+bool tok::ExpressionGraph::isBoolean(std::uint32_t node) const
+{
+    switch (this->nodes[node].op)
+    {
+    case tok::OPCODE::LNOT:
+    case tok::OPCODE::LAND:
+    case tok::OPCODE::LOR:
+        return true;
+    default:
+        return this->isConstant(node, 0.0) || this->isConstant(node, 1.0);
+    }
+}
+std::uint32_t tok::ExpressionGraph::rewrite(const tok::Node &node)
+{
+    if (!this->options.optimize)
+        return this->add(node);
+    int operands = tok::operands(node);
+    if (operands == 0)
+        return this->add(node);
+    if (node.op == tok::OPCODE::CALL)
+    {
+        // Only a pure function with constant arguments is folded.
+        const tok::FunctionEntry &function = tok::function(node.arg);
+        std::uint32_t indices[] = {node.operand1, node.operand2, node.operand3};
+        double arguments[tok::MAX_ARITY];
+        for (int i = 0; i < operands; i++)
+        {
+            if (this->nodes[indices[i]].op != tok::OPCODE::CONST)
+                return this->add(node);
+            arguments[i] = this->nodes[indices[i]].value;
+        }
+        if (!function.pure)
+            return this->add(node);
+        return this->constant(function.scalar(arguments), node.position);
+    }
+    if (node.op == tok::OPCODE::SELECT)
+    {
+        // A constant condition picks one arm, equal arms do not need one.
+        if (this->nodes[node.operand1].op == tok::OPCODE::CONST)
+            return tok::isTrue(this->nodes[node.operand1].value) ? node.operand2 : node.operand3;
+        if (node.operand2 == node.operand3 && this->pure[node.operand1])
+            return node.operand2;
+        return this->add(node);
+    }
+    const tok::Node &a = this->nodes[node.operand1];
+    const tok::Node &b = this->nodes[node.operand2];
+    // The integer %, & and | leave can have more bits than a double holds,
+    // those stay an operation rather than a rounded constant.
+    if (a.op == tok::OPCODE::CONST && (operands == 1 || b.op == tok::OPCODE::CONST) &&
+        (operands == 1 || exact(node.op, a.value, b.value)))
+        return this->constant(tok::apply(node.op, a.value, operands == 2 ? b.value : 0.0), node.position);
+    switch (node.op)
+    {
+    case tok::OPCODE::PLUS:
+        return node.operand1;
+    case tok::OPCODE::NEG:
+        // -(-x) = x
+        if (a.op == tok::OPCODE::NEG)
+            return a.operand1;
+        break;
+    case tok::OPCODE::LNOT:
+        // !!x = x for a boolean x
+        if (a.op == tok::OPCODE::LNOT && this->isBoolean(a.operand1))
+            return a.operand1;
+        break;
+    case tok::OPCODE::MUL:
+        if (this->isConstant(node.operand2, 1.0))
+            return node.operand1;
+        if (this->isConstant(node.operand1, 1.0))
+            return node.operand2;
+        if (this->options.finiteMath && ((this->isConstant(node.operand1, 0.0) && this->pure[node.operand2]) ||
+                                         (this->isConstant(node.operand2, 0.0) && this->pure[node.operand1])))
+            return this->constant(0.0, node.position);
+        break;
+    case tok::OPCODE::DIV:
+        if (this->isConstant(node.operand2, 1.0))
+            return node.operand1;
+        break;
+    case tok::OPCODE::ADD:
+        // x + -0 = x holds for every x, x + 0 does not for x = -0.
+        if (this->isConstant(node.operand2, -0.0) || (this->options.finiteMath && this->isConstant(node.operand2, 0.0)))
+            return node.operand1;
+        if (this->isConstant(node.operand1, -0.0) || (this->options.finiteMath && this->isConstant(node.operand1, 0.0)))
+            return node.operand2;
+        break;
+    case tok::OPCODE::SUB:
+        if (this->isConstant(node.operand2, 0.0))
+            return node.operand1;
+        break;
+    case tok::OPCODE::BAND:
+        // One operand that is 0 as an integer decides the result, unless the
+        // other one calls an impure function, which & always evaluates.
+        if ((a.op == tok::OPCODE::CONST && tok::integer(a.value) == 0 && this->pure[node.operand2]) ||
+            (b.op == tok::OPCODE::CONST && tok::integer(b.value) == 0 && this->pure[node.operand1]))
+            return this->constant(0.0, node.position);
+        break;
+    case tok::OPCODE::LAND:
+        // One operand that is 0 as an int decides the result. A left one
+        // skips the right operand anyway, a right one only goes for a left
+        // operand without impure calls.
+        if ((a.op == tok::OPCODE::CONST && tok::land(a.value, 1.0) == 0.0) ||
+            (b.op == tok::OPCODE::CONST && tok::land(b.value, 1.0) == 0.0 && this->pure[node.operand1]))
+            return this->constant(0.0, node.position);
+        break;
+    case tok::OPCODE::LOR:
+        if ((a.op == tok::OPCODE::CONST && tok::lor(a.value, 0.0) == 1.0) ||
+            (b.op == tok::OPCODE::CONST && tok::lor(b.value, 0.0) == 1.0 && this->pure[node.operand1]))
+            return this->constant(1.0, node.position);
+        break;
+    default:
+        break;
+    }
+    return this->add(node);
+}
+tok::CompiledExpression tok::ExpressionGraph::emit(tok::SymbolTable symbols) const
+{
+    return this->emit(std::move(symbols), {this->root}, false);
+}
+tok::CompiledExpression tok::ExpressionGraph::emit(tok::SymbolTable symbols, const std::vector<std::uint32_t> &roots) const
+{
+    return this->emit(std::move(symbols), roots, true);
+}
+tok::CompiledExpression tok::ExpressionGraph::emit(tok::SymbolTable symbols, const std::vector<std::uint32_t> &roots, bool yield) const
+{
+    // Rewriting leaves dead nodes behind, so count the uses starting at the roots.
+    std::vector<std::uint32_t> uses(this->nodes.size());
+    for (std::uint32_t root : roots)
+        uses[root]++;
+    for (std::size_t i = this->nodes.size(); i-- > 0;)
+    {
+        if (uses[i] == 0)
+            continue;
+        int operands = tok::operands(this->nodes[i]);
+        if (operands >= 1)
+            uses[this->nodes[i].operand1]++;
+        if (operands >= 2)
+            uses[this->nodes[i].operand2]++;
+        if (operands == 3)
+            uses[this->nodes[i].operand3]++;
+    }
+    std::vector<tok::Instruction> program;
+    std::vector<double> constants;
+    std::vector<unsigned> positions;
+    // Every distinct constant goes into the pool once:
+    std::unordered_map<std::uint64_t, std::uint32_t> pool;
+    // The temporary a shared node was stored into, or none yet:
+    const std::uint32_t NONE = UINT32_MAX;
+    std::vector<std::uint32_t> temporary(this->nodes.size(), NONE);
+    std::uint32_t temporaries = 0;
+    // Emit in postorder without recursing, a node is visited once to push its
+    // operands and a second time to emit the node itself.
+    std::vector<std::pair<std::uint32_t, bool>> work;
+    for (std::size_t k = 0; k < roots.size(); k++)
+    {
+        work.push_back({roots[k], false});
+        while (!work.empty())
+        {
+            std::uint32_t index = work.back().first;
+            bool visited = work.back().second;
+            work.pop_back();
+            const tok::Node &node = this->nodes[index];
+            int operands = tok::operands(node);
+            if (!visited && temporary[index] != NONE)
+            {
+                program.push_back({tok::OPCODE::RECALL, 0, 0, temporary[index]});
+                positions.push_back(node.position);
+                continue;
+            }
+            if (!visited)
+            {
+                work.push_back({index, true});
+                if (operands == 3)
+                    work.push_back({node.operand3, false});
+                if (operands >= 2)
+                    work.push_back({node.operand2, false});
+                if (operands >= 1)
+                    work.push_back({node.operand1, false});
+                continue;
+            }
+            tok::Instruction ins{node.op};
+            if (node.op == tok::OPCODE::CONST)
+            {
+                std::uint64_t bits;
+                std::memcpy(&bits, &node.value, sizeof(double));
+                auto it = pool.emplace(bits, constants.size());
+                if (it.second)
+                    constants.push_back(node.value);
+                ins.arg = it.first->second;
+            }
+            else if (node.op == tok::OPCODE::LOAD || node.op == tok::OPCODE::CALL)
+            {
+                ins.arg = node.arg;
+                ins.aux = node.aux;
+            }
+            program.push_back(ins);
+            positions.push_back(node.position);
+            // Constants and variables are as cheap to push again as a temporary.
+            if (uses[index] > 1 && operands != 0)
+            {
+                temporary[index] = temporaries++;
+                program.push_back({tok::OPCODE::STORE, 0, 0, temporary[index]});
+                positions.push_back(node.position);
+            }
+        }
+        if (!yield)
+            continue;
+        // Every root is left on the stack on top of the one before it.
+        const tok::Node &node = this->nodes[roots[k]];
+        program.push_back({tok::OPCODE::YIELD, 0, 0, (std::uint32_t)k});
+        positions.push_back(node.position);
+        if (k != 0)
+        {
+            program.push_back({tok::OPCODE::DROP});
+            positions.push_back(node.position);
+        }
+    }
+    tok::CompiledExpression result(std::move(program), std::move(constants), std::move(positions), std::move(symbols));
+    result.eliminated = this->eliminated;
+    return result;
+}
+tok::CompiledExpression tok::optimize(const tok::CompiledExpression &program, const tok::CompileOptions &options)
+{
+    return tok::ExpressionGraph(program, options).emit(program.getSymbols());
+}
@@ -0,0 +1,154 @@
+#pragma once
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include "Program.hpp"
+
+namespace tok
+{
+    /**
+     * One operation of an expression graph. The operands are indices of
+     * nodes that come earlier in the graph.
+     **/
+    struct Node
+    {
+        OPCODE op;
+        // The slot for OPCODE::LOAD, unused otherwise.
+        std::uint32_t arg;
+        std::uint32_t operand1;
+        std::uint32_t operand2;
+        // The value for OPCODE::CONST, unused otherwise.
+        double value;
+        unsigned position;
+        // The third argument and the number of arguments for OPCODE::CALL.
+        std::uint32_t operand3 = 0;
+        std::uint16_t aux = 0;
+    };
+    inline int operands(const Node &node)
+    {
+        return node.op == OPCODE::CALL ? node.aux : operands(node.op);
+    }
+    /**
+     * Identifies a node by what it computes, so that equal nodes are only
+     * added to the graph once.
+     **/
+    struct NodeKey
+    {
+        OPCODE op;
+        std::uint32_t arg;
+        std::uint32_t operand1;
+        std::uint32_t operand2;
+        std::uint64_t value;
+        std::uint32_t operand3;
+        bool operator==(const NodeKey &other) const
+        {
+            return op == other.op && arg == other.arg && operand1 == other.operand1 && operand2 == other.operand2 && value == other.value &&
+                   operand3 == other.operand3;
+        }
+    };
+    inline NodeKey key(const Node &node)
+    {
+        NodeKey key{node.op, node.arg, 0, 0, 0, 0};
+        int operands = tok::operands(node);
+        if (operands >= 1)
+            key.operand1 = node.operand1;
+        if (operands >= 2)
+            key.operand2 = node.operand2;
+        if (operands == 3)
+            key.operand3 = node.operand3;
+        if (node.op == OPCODE::CONST)
+            std::memcpy(&key.value, &node.value, sizeof(double));
+        return key;
+    }
+    struct NodeKeyHash
+    {
+        std::size_t operator()(const NodeKey &key) const
+        {
+            std::uint64_t hash = (std::uint64_t)key.op * 0x9E3779B97F4A7C15ull;
+            hash = (hash ^ key.arg) * 0x9E3779B97F4A7C15ull;
+            hash = (hash ^ key.operand1) * 0x9E3779B97F4A7C15ull;
+            hash = (hash ^ key.operand2) * 0x9E3779B97F4A7C15ull;
+            hash = (hash ^ key.value) * 0x9E3779B97F4A7C15ull;
+            hash = (hash ^ key.operand3) * 0x9E3779B97F4A7C15ull;
+            return hash ^ (hash >> 32);
+        }
+    };
+    /**
+     * A compiled program lifted into a graph, so that whole sub-expressions
+     * can be rewritten before it is emitted as a program again. With
+     * CompileOptions::cse equal sub-expressions share one node, which turns
+     * the tree into a DAG.
+     **/
+    struct ExpressionGraph
+    {
+    private:
+        std::vector<tok::Node> nodes;
+        // Whether a node calls no impure function, itself or in its operands.
+        // Only those may be dropped by a rewrite.
+        std::vector<bool> pure;
+        std::uint32_t root = 0;
+        tok::CompileOptions options;
+        std::unordered_map<tok::NodeKey, std::uint32_t, tok::NodeKeyHash> unique;
+        // The number of nodes that turned out to be equal to an existing one.
+        std::size_t eliminated = 0;
+
+        std::uint32_t add(const tok::Node &node);
+        std::uint32_t constant(double value, unsigned position);
+        bool isConstant(std::uint32_t node, double value) const;
+        bool isBoolean(std::uint32_t node) const;
+        /**
+         * Return the node computing the same value as the given one, folding
+         * constants and applying the identities the options allow.
+         **/
+        std::uint32_t rewrite(const tok::Node &node);
+        tok::CompiledExpression emit(tok::SymbolTable symbols, const std::vector<std::uint32_t> &roots, bool yield) const;
+
+    public:
+        explicit ExpressionGraph(const tok::CompileOptions &options) : options(options)
+        {
+        }
+        ExpressionGraph(const tok::CompiledExpression &program, const tok::CompileOptions &options);
+        /**
+         * Add the nodes of another program and return the node of its result.
+         * With symbols, its variables are resolved to the slots they have in
+         * there rather than keeping their own.
+         **/
+        std::uint32_t lift(const tok::CompiledExpression &program, tok::SymbolTable *symbols = nullptr);
+        inline const std::vector<tok::Node> &getNodes() const
+        {
+            return this->nodes;
+        }
+        inline std::uint32_t getRoot() const
+        {
+            return this->root;
+        }
+        inline std::size_t getEliminated() const
+        {
+            return this->eliminated;
+        }
+        /**
+         * Emit the nodes reachable from the root as a program again. A node
+         * used more than once is computed the first time and stored into a
+         * temporary that the later uses recall.
+         **/
+        tok::CompiledExpression emit(tok::SymbolTable symbols) const;
+        /**
+         * Emit the nodes reachable from any of the roots as one program that
+         * yields the value of the k-th root into output k and leaves the last
+         * one as its result. The roots share the temporaries of their common
+         * nodes.
+         **/
+        tok::CompiledExpression emit(tok::SymbolTable symbols, const std::vector<std::uint32_t> &roots) const;
+    };
+    /**
+     * Fold the constant sub-expressions of the program and simplify it.
+     * The result computes the same values as the program it was given.
+     **/
+    tok::CompiledExpression optimize(const tok::CompiledExpression &, const tok::CompileOptions &);
+}
+
+#endif
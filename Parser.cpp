@@ -0,0 +1,182 @@
+#include <stdexcept>
+#include "Token.hpp"
+#include "Functions.hpp"
+
+namespace
+{
+    // Every operator binds tighter than this.
+    const unsigned WEAKEST = UINT32_MAX;
+    // Parentheses, calls and operators nested deeper than this are rejected
+    // rather than running out of stack.
+    const unsigned MAX_NESTING = 10000;
+
+    /**
+     * Precedence climbing over the tokens, emitting every instruction as soon
+     * as its operands have been emitted. An operator parses its right operand
+     * with the operators that bind tighter than itself, equal ones included
+     * if it groups from the right, so the instructions come out in postfix
+     * order without an operator stack.
+     **/
+    struct Parser
+    {
+        const std::vector<tok::Token *> &tokens;
+        std::size_t next = 0;
+        unsigned depth = 0;
+        std::vector<tok::Instruction> program;
+        std::vector<double> constants;
+        std::vector<unsigned> positions;
+
+        explicit Parser(const std::vector<tok::Token *> &tokens) : tokens(tokens)
+        {
+            this->program.reserve(tokens.size());
+            this->positions.reserve(tokens.size());
+        }
+        inline tok::Token *peek() const
+        {
+            return this->next < this->tokens.size() ? this->tokens[this->next] : nullptr;
+        }
+        // The position behind the last token.
+        unsigned end() const
+        {
+            return this->tokens.back()->getPosition() + this->tokens.back()->getValue().size();
+        }
+        inline void emit(tok::Instruction ins, unsigned position)
+        {
+            this->program.push_back(ins);
+            this->positions.push_back(position);
+        }
+        /**
+         * Throw the error for a token that cannot follow a whole expression.
+         **/
+        [[noreturn]] void unexpected(tok::Token *tok) const
+        {
+            std::string at = " at " + std::to_string(tok->getPosition());
+            if (tok->isRightParen())
+                throw std::invalid_argument("Unbalanced parenthesis" + at);
+            if (tok->isComma())
+                throw std::invalid_argument("Comma outside of a function call" + at);
+            if (tok->isTernaryOperation())
+                throw std::invalid_argument(": without a ?" + at);
+            throw std::invalid_argument("Missing operator" + at);
+        }
+        void expression(unsigned weakest)
+        {
+            if (++this->depth > MAX_NESTING)
+                throw std::invalid_argument("Expression nested too deeply at " + std::to_string(this->peek() ? this->peek()->getPosition() : this->end()));
+            this->operand();
+            while (tok::Token *tok = this->peek())
+            {
+                unsigned precedence = tok->getPrecedence();
+                if (precedence > weakest)
+                    break;
+                if (tok->isBinaryOperation())
+                {
+                    this->next++;
+                    this->expression(tok->isRightAssociative() ? precedence : precedence - 1);
+                    this->emit({tok->getOpcode()}, tok->getPosition());
+                }
+                else if (tok->isTernaryOperation() && tok->getOpcode() == tok::OPCODE::SELECT)
+                {
+                    this->next++;
+                    // Anything goes up to the colon:
+                    this->expression(WEAKEST);
+                    tok::Token *colon = this->peek();
+                    if (!colon || !colon->isTernaryOperation() || colon->getOpcode() == tok::OPCODE::SELECT)
+                        throw std::invalid_argument("? without a : at " + std::to_string(tok->getPosition()));
+                    this->next++;
+                    this->expression(tok->isRightAssociative() ? precedence : precedence - 1);
+                    this->emit({tok::OPCODE::SELECT}, tok->getPosition());
+                }
+                else
+                {
+                    break;
+                }
+            }
+            this->depth--;
+        }
+        void operand()
+        {
+            tok::Token *tok = this->peek();
+            if (!tok)
+                throw std::invalid_argument("Missing operand at " + std::to_string(this->end()));
+            this->next++;
+            if (tok->isLiteral())
+            {
+                this->emit({tok::OPCODE::CONST, 0, 0, (std::uint32_t)this->constants.size()}, tok->getPosition());
+                this->constants.push_back(tok->getConstant());
+            }
+            else if (tok->isUnaryOperation())
+            {
+                this->expression(tok->getPrecedence() - 1);
+                this->emit({tok->getOpcode()}, tok->getPosition());
+            }
+            else if (tok->isLeftParen())
+            {
+                this->expression(WEAKEST);
+                this->close(tok);
+            }
+            else if (tok->isFunction())
+            {
+                this->call(tok);
+            }
+            else if (tok->getOpcode() == tok::OPCODE::LOAD)
+            {
+                this->emit({tok::OPCODE::LOAD, 0, 0, tok->getSlot()}, tok->getPosition());
+            }
+            else
+            {
+                throw std::invalid_argument("Missing operand at " + std::to_string(tok->getPosition()));
+            }
+        }
+        // Consume the right parenthesis that closes the given left one.
+        void close(tok::Token *open)
+        {
+            tok::Token *tok = this->peek();
+            if (!tok)
+                throw std::invalid_argument("Unbalanced parenthesis at " + std::to_string(open->getPosition()));
+            if (!tok->isRightParen())
+                this->unexpected(tok);
+            this->next++;
+        }
+        void call(tok::Token *function)
+        {
+            // The tokenizer only makes a function of a name followed by (.
+            tok::Token *open = this->tokens[this->next++];
+            unsigned arguments = 0;
+            tok::Token *tok = this->peek();
+            if (!tok || !tok->isRightParen())
+            {
+                while (true)
+                {
+                    this->expression(WEAKEST);
+                    arguments++;
+                    tok = this->peek();
+                    if (!tok || !tok->isComma())
+                        break;
+                    this->next++;
+                }
+            }
+            this->close(open);
+            tok::Instruction ins{tok::OPCODE::CALL};
+            ins.arg = function->getFunction();
+            ins.aux = tok::function(ins.arg).arity;
+            for (unsigned calls = tok::calls(ins.arg, arguments, function->getPosition()); calls > 0; calls--)
+                this->emit(ins, function->getPosition());
+        }
+    };
+}
+/**
+ * Parse the tokens straight into a program, like infixtopostfix followed by
+ * assemble but in a single pass. Throws std::invalid_argument at the first
+ * token that does not fit.
+ **/
+tok::CompiledExpression tok::parse(const std::vector<tok::Token *> &tokens, tok::SymbolTable symbols)
+{
+    Parser parser(tokens);
+    if (tokens.empty())
+        throw std::invalid_argument("Empty expression");
+    parser.expression(WEAKEST);
+    if (parser.peek())
+        parser.unexpected(parser.peek());
+    return tok::CompiledExpression(std::move(parser.program), std::move(parser.constants), std::move(parser.positions), std::move(symbols));
+}
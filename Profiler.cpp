@@ -0,0 +1,58 @@
+#include <algorithm>
+#include <vector>
+#include "Profiler.hpp"
+
+tok::PairProfile::PairProfile()
+{
+    this->reset();
+}
+void tok::PairProfile::record(const tok::CompiledExpression &program, std::uint64_t runs)
+{
+    const std::vector<tok::Instruction> &code = program.getProgram();
+    for (std::size_t i = 1; i < code.size(); i++)
+        this->counts[(std::size_t)code[i - 1].op][(std::size_t)code[i].op].fetch_add(runs, std::memory_order_relaxed);
+}
+std::uint64_t tok::PairProfile::count(tok::OPCODE first, tok::OPCODE second) const
+{
+    return this->counts[(std::size_t)first][(std::size_t)second].load(std::memory_order_relaxed);
+}
+void tok::PairProfile::reset()
+{
+    for (auto &row : this->counts)
+    {
+        for (std::atomic<std::uint64_t> &count : row)
+            count.store(0, std::memory_order_relaxed);
+    }
+}
+void tok::PairProfile::report(std::ostream &out, std::size_t top) const
+{
+    struct Pair
+    {
+        std::uint64_t count;
+        tok::OPCODE first;
+        tok::OPCODE second;
+    };
+    std::vector<Pair> pairs;
+    std::uint64_t total = 0;
+    for (std::size_t first = 0; first < tok::OPCODES; first++)
+    {
+        for (std::size_t second = 0; second < tok::OPCODES; second++)
+        {
+            std::uint64_t count = this->count((tok::OPCODE)first, (tok::OPCODE)second);
+            total += count;
+            if (count != 0)
+                pairs.push_back({count, (tok::OPCODE)first, (tok::OPCODE)second});
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](const Pair &a, const Pair &b) { return a.count > b.count; });
+    if (pairs.size() > top)
+        pairs.resize(top);
+    for (const Pair &pair : pairs)
+        out << tok::name(pair.first) << ' ' << tok::name(pair.second) << '\t' << pair.count << '\t'
+            << 100.0 * pair.count / total << "%\n";
+}
+tok::PairProfile &tok::pairProfile()
+{
+    static tok::PairProfile profile;
+    return profile;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include "Program.hpp"
+
+namespace tok
+{
+    /**
+     * Counts how often every opcode is directly followed by every other one in
+     * the programs that are run, weighted by the number of rows they run for.
+     * The most frequent pairs of a real workload are the candidates for new
+     * superinstructions. Off unless enabled, costing one load per run then.
+     **/
+    struct PairProfile
+    {
+    private:
+        std::atomic<bool> enabled{false};
+        std::atomic<std::uint64_t> counts[tok::OPCODES][tok::OPCODES];
+
+    public:
+        PairProfile();
+        PairProfile(const PairProfile &) = delete;
+        PairProfile &operator=(const PairProfile &) = delete;
+        inline void enable(bool enabled = true)
+        {
+            this->enabled.store(enabled, std::memory_order_relaxed);
+        }
+        inline bool isEnabled() const
+        {
+            return this->enabled.load(std::memory_order_relaxed);
+        }
+        /**
+         * Add the pairs of the program, each counted once per run.
+         **/
+        void record(const tok::CompiledExpression &program, std::uint64_t runs);
+        std::uint64_t count(tok::OPCODE first, tok::OPCODE second) const;
+        void reset();
+        /**
+         * Write the most frequent pairs, one per line, most frequent first.
+         **/
+        void report(std::ostream &out, std::size_t top = 20) const;
+    };
+    /**
+     * The profile every evaluation records into while it is enabled.
+     **/
+    tok::PairProfile &pairProfile();
+}
+
+#endif
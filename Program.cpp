@@ -0,0 +1,878 @@
+#include <stdexcept>
+#include <algorithm>
+#include "Token.hpp"
+#include "Program.hpp"
+#include "Kernels.hpp"
+#include "Optimizer.hpp"
+#include "Jit.hpp"
+#include "Profiler.hpp"
+#include "ThreadPool.hpp"
+#include "Trace.hpp"
+#include "Functions.hpp"
+/**
+ * Tokenize and parse the expression once, resolving every token to its
+ * instruction so that the result can be run repeatedly.
+ * The tokens only live for the duration of the call, so they are made from
+ * an arena that every compile on this thread reuses.
+ **/
+tok::CompiledExpression tok::compile(std::string_view expr, const tok::CompileOptions &options)
+{
+    thread_local tok::Arena arena;
+    // Drop whatever an earlier compile left behind when it threw.
+    arena.reset();
+    tok::SymbolTable symbols;
+    std::vector<tok::Token *> tokens;
+    {
+        TOK_TIMER(TOKENIZE);
+        tokens = tokenization(expr, symbols, arena);
+    }
+    TOK_COUNT(tokens, tokens.size());
+    TOK_LOG("Tokens of " << expr << ": " << tok::toString(tokens));
+    tok::CompiledExpression program;
+    {
+        TOK_TIMER(PARSE);
+        program = tok::parse(tokens, std::move(symbols));
+    }
+    arena.reset();
+    if (options.optimize)
+    {
+        TOK_TIMER(OPTIMIZE);
+        program = tok::optimize(program, options);
+    }
+    if (!options.superinstructions)
+        program.thread(false);
+    TOK_LOG("Types of " << expr << ":\n" << tok::typeReport(program));
+    program.enableJit(options.jitThreshold);
+    return program;
+}
+/**
+ * Parse every expression on its own and lift them all into one graph, where
+ * the nodes they have in common are merged like any other equal nodes.
+ **/
+tok::CompiledExpression tok::compile(const std::vector<std::string_view> &exprs, const tok::CompileOptions &options)
+{
+    if (exprs.empty())
+        throw std::invalid_argument("Empty set of expressions");
+    tok::CompileOptions parseOnly;
+    parseOnly.optimize = false;
+    parseOnly.jitThreshold = 0;
+    tok::SymbolTable symbols;
+    tok::ExpressionGraph graph(options);
+    std::vector<std::uint32_t> roots;
+    roots.reserve(exprs.size());
+    for (std::string_view expr : exprs)
+        roots.push_back(graph.lift(tok::compile(expr, parseOnly), &symbols));
+    tok::CompiledExpression program;
+    {
+        TOK_TIMER(OPTIMIZE);
+        program = graph.emit(std::move(symbols), roots);
+    }
+    if (!options.superinstructions)
+        program.thread(false);
+    program.enableJit(options.jitThreshold);
+    return program;
+}
+/**
+ * Pack the postfix tokens into instructions. Constants move into the constant
+ * pool and the source positions into the side table.
+ **/
+tok::CompiledExpression tok::assemble(std::vector<tok::Token *> postfix, tok::SymbolTable symbols)
+{
+    TOK_TIMER(ASSEMBLE);
+    std::vector<tok::Instruction> program;
+    std::vector<double> constants;
+    std::vector<unsigned> positions;
+    program.reserve(postfix.size());
+    positions.reserve(postfix.size());
+    for (tok::Token *&tok : postfix)
+    {
+        // A parenthesis only ends up in the postfix if it has no partner.
+        if (tok->isParenthesis())
+            throw std::invalid_argument("Unbalanced parenthesis at " + std::to_string(tok->getPosition()));
+        if (tok->isTernaryOperation() && tok->getOperands() != 3)
+            throw std::invalid_argument("? without a : at " + std::to_string(tok->getPosition()));
+        tok::Instruction ins{tok->getOpcode()};
+        if (ins.op == tok::OPCODE::CONST)
+        {
+            ins.arg = constants.size();
+            constants.push_back(tok->getConstant());
+        }
+        else if (ins.op == tok::OPCODE::LOAD)
+        {
+            ins.arg = tok->getSlot();
+        }
+        else if (ins.op == tok::OPCODE::CALL)
+        {
+            ins.arg = tok->getFunction();
+            ins.aux = tok::function(ins.arg).arity;
+            // The extra arguments of a variadic function are folded from the
+            // right, one more call each:
+            for (unsigned calls = tok::calls(ins.arg, tok->getOperands(), tok->getPosition()); calls > 1; calls--)
+            {
+                program.push_back(ins);
+                positions.push_back(tok->getPosition());
+            }
+        }
+        program.push_back(ins);
+        positions.push_back(tok->getPosition());
+    }
+    return tok::CompiledExpression(std::move(program), std::move(constants), std::move(positions), std::move(symbols));
+}
+std::vector<double> tok::CompiledExpression::bind(const std::unordered_map<std::string, double> &values) const
+{
+    std::vector<double> bindings(this->symbols.size());
+    for (unsigned slot = 0; slot < bindings.size(); slot++)
+    {
+        auto it = values.find(this->symbols.getName(slot));
+        if (it == values.end())
+            throw std::invalid_argument("No value for variable " + this->symbols.getName(slot));
+        bindings[slot] = it->second;
+    }
+    return bindings;
+}
+double tok::CompiledExpression::run() const
+{
+    if (this->symbols.size() != 0)
+        throw std::invalid_argument("The expression has unbound variables");
+    return this->run(nullptr);
+}
+void tok::CompiledExpression::enableJit(std::uint64_t threshold)
+{
+    if (threshold != 0 && tok::jitSupported())
+        this->jit = std::make_shared<tok::JitState>(threshold);
+    else
+        this->jit = nullptr;
+}
+bool tok::CompiledExpression::isJitted() const
+{
+    return this->jit && this->jit->getCode();
+}
+void tok::CompiledExpression::verify()
+{
+    std::size_t depth = 0;
+    // Which temporaries have been stored so far:
+    std::vector<bool> stored;
+    this->maxDepth = 0;
+    this->outputs = 0;
+    for (std::size_t i = 0; i < this->program.size(); i++)
+    {
+        const tok::Instruction &ins = this->program[i];
+        std::size_t needed = tok::operands(ins);
+        if (depth < needed)
+            throw std::invalid_argument("Missing operand at " + std::to_string(this->positions[i]));
+        if (ins.op == tok::OPCODE::STORE && ins.arg >= stored.size())
+            stored.resize((std::size_t)ins.arg + 1);
+        if (ins.op == tok::OPCODE::STORE)
+            stored[ins.arg] = true;
+        if (ins.op == tok::OPCODE::RECALL && (ins.arg >= stored.size() || !stored[ins.arg]))
+            throw std::invalid_argument("Temporary recalled before it is stored at " + std::to_string(this->positions[i]));
+        if (ins.op == tok::OPCODE::YIELD)
+            this->outputs = std::max<std::size_t>(this->outputs, (std::size_t)ins.arg + 1);
+        // Every operation leaves exactly one value behind:
+        depth = depth - needed + 1;
+        this->maxDepth = std::max(this->maxDepth, depth);
+    }
+    if (depth != 1)
+        throw std::invalid_argument(depth == 0 ? "Empty expression" : "Missing operator in expression");
+    this->temporaries = stored.size();
+}
+namespace
+{
+    // The handlers behind the last opcode, the superinstructions are numbered
+    // ADD, SUB, MUL, DIV within every group:
+    enum HANDLER : std::size_t
+    {
+        ADD_LL = tok::OPCODES, // LOAD LOAD op
+        ADD_LC = ADD_LL + 4,   // LOAD CONST op
+        ADD_L = ADD_LC + 4,    // LOAD op
+        ADD_C = ADD_L + 4,     // CONST op
+        SKIP_FALSE = ADD_C + 4, // && jumps to the end with 0 if its left operand is false.
+        SKIP_TRUE,             // || jumps to the end with 1 if its left operand is true.
+        BRANCH,                // ?: jumps to the else arm if the condition is false.
+        JUMP,                  // The end of the then arm jumps past the else arm.
+        TRUTH,                 // The truth value of a right operand that was not skipped.
+        ICONST,                // Push the integer with the low half in arg and the high half in arg2.
+        ILOAD,                 // Push the binding in the given slot as an integer.
+        IMOD,                  // % by a divisor other than 0, which leaves an integer.
+        TO_INTEGER,            // Convert the topmost value to an integer.
+        TO_REAL,               // Convert the topmost value to a double.
+        END,                   // Return the topmost value.
+        HANDLERS
+    };
+    /**
+     * Run threaded code. Every handler jumps straight to the handler of the
+     * next instruction, so there is one indirect branch per instruction that
+     * the CPU predicts per handler rather than one shared by all of them.
+     * Called without code, it only hands out the addresses of its handlers.
+     **/
+    double interpret(const tok::ThreadedInstruction *ip, const double *bindings, const double *constants,
+                     double *sp, double *temporaries, double *outputs, const void *const **handlers)
+    {
+        static const void *const table[HANDLERS] = {
+            &&CONST, &&LOAD, &&PLUS, &&NEG, &&LNOT, &&ADD, &&SUB, &&MUL, &&DIV, &&MOD, &&BAND, &&BOR, &&LAND, &&LOR, &&STORE, &&RECALL, &&CALL, &&SELECT,
+            &&YIELD, &&DROP,
+            &&ADD_LL, &&SUB_LL, &&MUL_LL, &&DIV_LL,
+            &&ADD_LC, &&SUB_LC, &&MUL_LC, &&DIV_LC,
+            &&ADD_L, &&SUB_L, &&MUL_L, &&DIV_L,
+            &&ADD_C, &&SUB_C, &&MUL_C, &&DIV_C,
+            &&SKIP_FALSE, &&SKIP_TRUE, &&BRANCH, &&JUMP, &&TRUTH,
+            &&ICONST, &&ILOAD, &&IMOD, &&TO_INTEGER, &&TO_REAL,
+            &&END};
+        if (!ip)
+        {
+            *handlers = table;
+            return 0.0;
+        }
+        // Jump targets are indices into the code.
+        const tok::ThreadedInstruction *code = ip;
+// sp points behind the topmost value.
+#define NEXT goto *(++ip)->handler
+#define TAKE            \
+    ip = code + ip->arg; \
+    goto *ip->handler
+#define BINARY(expression) \
+    sp--;                  \
+    sp[-1] = expression;   \
+    NEXT
+        goto *ip->handler;
+    CONST:
+        *sp++ = constants[ip->arg];
+        NEXT;
+    LOAD:
+        *sp++ = bindings[ip->arg];
+        NEXT;
+    ICONST:
+        *sp++ = tok::pack((std::int64_t)((std::uint64_t)ip->arg2 << 32 | ip->arg));
+        NEXT;
+    ILOAD:
+        *sp++ = tok::pack(tok::integer(bindings[ip->arg]));
+        NEXT;
+    TO_INTEGER:
+        sp[-1] = tok::pack(tok::integer(sp[-1]));
+        NEXT;
+    TO_REAL:
+        sp[-1] = (double)tok::unpack(sp[-1]);
+        NEXT;
+    STORE:
+        temporaries[ip->arg] = sp[-1];
+        NEXT;
+    RECALL:
+        *sp++ = temporaries[ip->arg];
+        NEXT;
+    YIELD:
+        outputs[ip->arg] = sp[-1];
+        NEXT;
+    DROP:
+        BINARY(sp[0]);
+    CALL:
+        // The arguments are replaced by the result:
+        sp -= ip->arg2;
+        *sp = tok::function(ip->arg).scalar(sp);
+        sp++;
+        NEXT;
+    SELECT:
+        sp -= 2;
+        sp[-1] = tok::isTrue(sp[-1]) ? sp[0] : sp[1];
+        NEXT;
+    SKIP_FALSE:
+        if (!tok::isTrue(sp[-1]))
+        {
+            sp[-1] = 0.0;
+            TAKE;
+        }
+        sp--;
+        NEXT;
+    SKIP_TRUE:
+        if (tok::isTrue(sp[-1]))
+        {
+            sp[-1] = 1.0;
+            TAKE;
+        }
+        sp--;
+        NEXT;
+    BRANCH:
+        sp--;
+        if (!tok::isTrue(sp[0]))
+        {
+            TAKE;
+        }
+        NEXT;
+    JUMP:
+        TAKE;
+    TRUTH:
+        sp[-1] = tok::isTrue(sp[-1]);
+        NEXT;
+    PLUS:
+        NEXT;
+    NEG:
+        sp[-1] = -sp[-1];
+        NEXT;
+    LNOT:
+        sp[-1] = tok::lnot(sp[-1]);
+        NEXT;
+    ADD:
+        BINARY(sp[-1] + sp[0]);
+    SUB:
+        BINARY(sp[-1] - sp[0]);
+    MUL:
+        BINARY(sp[-1] * sp[0]);
+    DIV:
+        BINARY(sp[-1] / sp[0]);
+    // The integer operators find their operands converted already.
+    MOD:
+        BINARY(tok::remainder(tok::unpack(sp[-1]), tok::unpack(sp[0])));
+    IMOD:
+        BINARY(tok::pack(tok::mod(tok::unpack(sp[-1]), tok::unpack(sp[0]))));
+    BAND:
+        BINARY(tok::pack(tok::unpack(sp[-1]) & tok::unpack(sp[0])));
+    BOR:
+        BINARY(tok::pack(tok::unpack(sp[-1]) | tok::unpack(sp[0])));
+    LAND:
+        BINARY(tok::land(sp[-1], sp[0]));
+    LOR:
+        BINARY(tok::lor(sp[-1], sp[0]));
+    ADD_LL:
+        *sp++ = bindings[ip->arg] + bindings[ip->arg2];
+        NEXT;
+    SUB_LL:
+        *sp++ = bindings[ip->arg] - bindings[ip->arg2];
+        NEXT;
+    MUL_LL:
+        *sp++ = bindings[ip->arg] * bindings[ip->arg2];
+        NEXT;
+    DIV_LL:
+        *sp++ = bindings[ip->arg] / bindings[ip->arg2];
+        NEXT;
+    ADD_LC:
+        *sp++ = bindings[ip->arg] + constants[ip->arg2];
+        NEXT;
+    SUB_LC:
+        *sp++ = bindings[ip->arg] - constants[ip->arg2];
+        NEXT;
+    MUL_LC:
+        *sp++ = bindings[ip->arg] * constants[ip->arg2];
+        NEXT;
+    DIV_LC:
+        *sp++ = bindings[ip->arg] / constants[ip->arg2];
+        NEXT;
+    ADD_L:
+        sp[-1] = sp[-1] + bindings[ip->arg];
+        NEXT;
+    SUB_L:
+        sp[-1] = sp[-1] - bindings[ip->arg];
+        NEXT;
+    MUL_L:
+        sp[-1] = sp[-1] * bindings[ip->arg];
+        NEXT;
+    DIV_L:
+        sp[-1] = sp[-1] / bindings[ip->arg];
+        NEXT;
+    ADD_C:
+        sp[-1] = sp[-1] + constants[ip->arg];
+        NEXT;
+    SUB_C:
+        sp[-1] = sp[-1] - constants[ip->arg];
+        NEXT;
+    MUL_C:
+        sp[-1] = sp[-1] * constants[ip->arg];
+        NEXT;
+    DIV_C:
+        sp[-1] = sp[-1] / constants[ip->arg];
+        NEXT;
+    END:
+        return sp[-1];
+#undef BINARY
+#undef TAKE
+#undef NEXT
+    }
+    /**
+     * The rows a skippable operand runs on within a block of the batch
+     * evaluation, and the rows of the selection enclosing it.
+     **/
+    struct Selection
+    {
+        std::uint32_t owner;
+        std::uint16_t rows[tok::BLOCK_SIZE];
+        std::size_t outerCount;
+        const std::uint16_t *outerLive;
+    };
+    // The offset of the operation within a group of superinstructions, or -1
+    // if there are none for it.
+    int arithmetic(tok::OPCODE op)
+    {
+        if (op == tok::OPCODE::ADD || op == tok::OPCODE::SUB || op == tok::OPCODE::MUL || op == tok::OPCODE::DIV)
+            return (int)op - (int)tok::OPCODE::ADD;
+        return -1;
+    }
+    /**
+     * Find the operands that can be skipped: the right operand of LAND and LOR
+     * and both arms of SELECT. An operand that stores a temporary recalled
+     * behind it has to run every time, its operator is evaluated eagerly.
+     **/
+    std::vector<std::uint32_t> skippable(const std::vector<tok::Instruction> &code)
+    {
+        std::vector<std::uint32_t> skips(code.size(), tok::NO_SKIP);
+        // The first instruction of every value on the stack:
+        std::vector<std::uint32_t> starts;
+        // The last instruction recalling every temporary:
+        std::vector<std::size_t> lastRecall;
+        for (std::size_t i = 0; i < code.size(); i++)
+        {
+            if (code[i].op != tok::OPCODE::RECALL)
+                continue;
+            lastRecall.resize(std::max<std::size_t>(lastRecall.size(), code[i].arg + 1));
+            lastRecall[code[i].arg] = i;
+        }
+        // Whether the instructions from first up to end can be left out.
+        auto independent = [&](std::size_t first, std::size_t end) {
+            for (std::size_t i = first; i < end; i++)
+            {
+                if (code[i].op == tok::OPCODE::STORE && code[i].arg < lastRecall.size() && lastRecall[code[i].arg] >= end)
+                    return false;
+            }
+            return true;
+        };
+        for (std::size_t i = 0; i < code.size(); i++)
+        {
+            int operands = tok::operands(code[i]);
+            std::size_t first = starts.size() - operands;
+            std::uint32_t start = operands ? starts[first] : i;
+            if ((code[i].op == tok::OPCODE::LAND || code[i].op == tok::OPCODE::LOR) && independent(starts[first + 1], i))
+            {
+                skips[starts[first + 1]] = i;
+            }
+            else if (code[i].op == tok::OPCODE::SELECT && independent(starts[first + 1], starts[first + 2]) &&
+                     independent(starts[first + 2], i))
+            {
+                skips[starts[first + 1]] = i;
+                skips[starts[first + 2]] = i;
+            }
+            starts.resize(first);
+            starts.push_back(start);
+        }
+        return skips;
+    }
+    // A program that yields values writes them through the outputs, it
+    // cannot run without them.
+    void needOutputs(const tok::CompiledExpression &program, bool given)
+    {
+        if (program.getOutputs() != 0 && !given)
+            throw std::invalid_argument("The program yields " + std::to_string(program.getOutputs()) + " values and needs outputs for them");
+    }
+}
+void tok::CompiledExpression::thread(bool fuse)
+{
+    const void *const *handlers;
+    interpret(nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, &handlers);
+    const std::vector<tok::Instruction> &code = this->program;
+    this->skips = skippable(code);
+    this->typing = tok::inferTypes(code, this->constants);
+    this->threaded.clear();
+    this->threaded.reserve(code.size() + 1);
+    // The operators that skip operands:
+    std::vector<bool> skipping(code.size());
+    for (std::uint32_t owner : this->skips)
+    {
+        if (owner != tok::NO_SKIP)
+            skipping[owner] = true;
+    }
+    // Where the code of every instruction starts, ahead of the jumps placed
+    // in front of it:
+    std::vector<std::uint32_t> before(code.size() + 1);
+    // The jumps to the end of an operator, by the instruction behind it:
+    std::vector<std::pair<std::size_t, std::size_t>> ends;
+    // The BRANCH of every SELECT whose else arm has not been reached yet:
+    const std::size_t NONE = SIZE_MAX;
+    std::vector<std::size_t> branches(code.size(), NONE);
+    // The value of an instruction is converted ahead of whatever comes next,
+    // so that the jumps to the end of an operator land on its conversion.
+    auto convert = [&](std::size_t i) {
+        const tok::Typing &typing = this->typing[i];
+        if (typing.type != typing.consumed)
+            this->threaded.push_back({handlers[typing.consumed == tok::TYPE::INTEGER ? TO_INTEGER : TO_REAL]});
+    };
+    for (std::size_t i = 0; i < code.size(); i++)
+    {
+        before[i] = this->threaded.size();
+        if (i != 0)
+            convert(i - 1);
+        std::uint32_t owner = this->skips[i];
+        if (owner != tok::NO_SKIP && code[owner].op != tok::OPCODE::SELECT)
+        {
+            ends.push_back({this->threaded.size(), owner + 1});
+            this->threaded.push_back({handlers[code[owner].op == tok::OPCODE::LAND ? SKIP_FALSE : SKIP_TRUE]});
+        }
+        else if (owner != tok::NO_SKIP && branches[owner] == NONE)
+        {
+            branches[owner] = this->threaded.size();
+            this->threaded.push_back({handlers[BRANCH]});
+        }
+        else if (owner != tok::NO_SKIP)
+        {
+            ends.push_back({this->threaded.size(), owner + 1});
+            this->threaded.push_back({handlers[JUMP]});
+            this->threaded[branches[owner]].arg = this->threaded.size();
+        }
+        // An unary plus does nothing at all:
+        if (code[i].op == tok::OPCODE::PLUS)
+            continue;
+        // The operator of skipped operands only turns the value it is left
+        // with into a truth value, if at all:
+        if (skipping[i])
+        {
+            if (code[i].op != tok::OPCODE::SELECT)
+                this->threaded.push_back({handlers[TRUTH]});
+            continue;
+        }
+        std::size_t rest = code.size() - i;
+        // Jump targets must not end up within a superinstruction:
+        int first = rest >= 2 && this->skips[i + 1] == tok::NO_SKIP ? arithmetic(code[i + 1].op) : -1;
+        int second = rest >= 3 && this->skips[i + 1] == tok::NO_SKIP && this->skips[i + 2] == tok::NO_SKIP ? arithmetic(code[i + 2].op) : -1;
+        if (fuse && code[i].op == tok::OPCODE::LOAD && second >= 0 &&
+            (code[i + 1].op == tok::OPCODE::LOAD || code[i + 1].op == tok::OPCODE::CONST))
+        {
+            std::size_t group = code[i + 1].op == tok::OPCODE::LOAD ? ADD_LL : ADD_LC;
+            this->threaded.push_back({handlers[group + second], code[i].arg, code[i + 1].arg});
+            i += 2;
+        }
+        else if (fuse && (code[i].op == tok::OPCODE::LOAD || code[i].op == tok::OPCODE::CONST) && first >= 0)
+        {
+            std::size_t group = code[i].op == tok::OPCODE::LOAD ? ADD_L : ADD_C;
+            this->threaded.push_back({handlers[group + first], code[i].arg});
+            i += 1;
+        }
+        else if (this->typing[i].type == tok::TYPE::INTEGER && code[i].op == tok::OPCODE::CONST)
+        {
+            std::uint64_t value = tok::integer(this->constants[code[i].arg]);
+            this->threaded.push_back({handlers[ICONST], (std::uint32_t)value, (std::uint32_t)(value >> 32)});
+        }
+        else if (this->typing[i].type == tok::TYPE::INTEGER && (code[i].op == tok::OPCODE::LOAD || code[i].op == tok::OPCODE::MOD))
+        {
+            this->threaded.push_back({handlers[code[i].op == tok::OPCODE::LOAD ? ILOAD : IMOD], code[i].arg});
+        }
+        else
+        {
+            this->threaded.push_back({handlers[(std::size_t)code[i].op], code[i].arg, code[i].aux});
+        }
+    }
+    before[code.size()] = this->threaded.size();
+    if (!code.empty())
+        convert(code.size() - 1);
+    for (const std::pair<std::size_t, std::size_t> &end : ends)
+        this->threaded[end.first].arg = before[end.second];
+    this->threaded.push_back({handlers[END]});
+}
+double tok::CompiledExpression::run(const double *bindings, double *outputs) const
+{
+    needOutputs(*this, outputs);
+    if (tok::pairProfile().isEnabled())
+        tok::pairProfile().record(*this, 1);
+    TOK_TIMER(EVALUATE);
+    TOK_COUNT_PROGRAM(*this, 1);
+    double local[tok::LOCAL_STACK_SIZE];
+    std::vector<double> heap;
+    double *stack = local;
+    // The temporaries are kept behind the stack.
+    if (this->maxDepth + this->temporaries > tok::LOCAL_STACK_SIZE)
+    {
+        heap.resize(this->maxDepth + this->temporaries);
+        stack = heap.data();
+    }
+    double *temporaries = stack + this->maxDepth;
+    if (this->jit)
+    {
+        const tok::JitCode *code = this->jit->getCode();
+        if (code)
+            return code->scalar(bindings, this->constants.data(), temporaries, outputs);
+        this->jit->count(*this, 1);
+    }
+    return interpret(this->threaded.data(), bindings, this->constants.data(), stack, temporaries, outputs, nullptr);
+}
+void tok::CompiledExpression::run(const double *const *columns, std::size_t rows, double *out, double *const *outputs) const
+{
+    needOutputs(*this, outputs);
+    if (tok::pairProfile().isEnabled())
+        tok::pairProfile().record(*this, rows);
+    TOK_TIMER(EVALUATE);
+    TOK_COUNT_PROGRAM(*this, rows);
+    if (this->jit)
+    {
+        const tok::JitCode *code = this->jit->getCode();
+        if (code && code->block)
+        {
+            // The native loop takes two rows at a time, an odd one is left over.
+            std::size_t even = rows & ~(std::size_t)1;
+            std::vector<double> temporaries(2 * this->temporaries);
+            code->block(columns, even, out, this->constants.data(), temporaries.data());
+            if (even != rows)
+            {
+                std::vector<double> bindings(this->symbols.size());
+                for (std::size_t slot = 0; slot < bindings.size(); slot++)
+                    bindings[slot] = columns[slot][even];
+                out[even] = this->run(bindings.data(), nullptr);
+            }
+            return;
+        }
+        if (!code)
+            this->jit->count(*this, rows);
+    }
+    const tok::Kernels &kernels = tok::kernels();
+    // Every stack entry is a whole block of rows. Each thread keeps its stack
+    // for the next call, so that chunks of a parallel run do not allocate.
+    thread_local std::vector<double> stack;
+    stack.resize(std::max(stack.size(), (this->maxDepth + this->temporaries) * tok::BLOCK_SIZE));
+    double *temporaries = stack.data() + this->maxDepth * tok::BLOCK_SIZE;
+    // The selections of the skippable operands being evaluated, innermost
+    // last. A deque, so that the rows stay where they are.
+    thread_local std::deque<Selection> selections;
+    for (std::size_t base = 0; base < rows; base += tok::BLOCK_SIZE)
+    {
+        std::size_t n = std::min(tok::BLOCK_SIZE, rows - base);
+        // Points behind the topmost block:
+        double *top = stack.data();
+        // The rows still live, the entries of a block are compacted to them.
+        // Null while every row of the block is live.
+        const std::uint16_t *live = nullptr;
+        std::size_t depth = 0;
+        for (std::size_t i = 0; i < this->program.size(); i++)
+        {
+            const tok::Instruction &ins = this->program[i];
+            // Like the threaded code, the value of the previous instruction is
+            // converted before anything else looks at it.
+            if (i != 0 && this->typing[i - 1].type != this->typing[i - 1].consumed)
+                (this->typing[i - 1].consumed == tok::TYPE::INTEGER ? kernels.toInteger : kernels.toReal)(top - tok::BLOCK_SIZE, n);
+            std::uint32_t owner = this->skips[i];
+            if (owner != tok::NO_SKIP)
+            {
+                // A skippable operand starts, it only runs on the rows whose
+                // result is not decided yet. The else arm of a SELECT takes
+                // the rows its then arm did not.
+                const tok::OPCODE op = this->program[owner].op;
+                bool otherwise = depth != 0 && selections[depth - 1].owner == owner;
+                if (otherwise)
+                {
+                    depth--;
+                    n = selections[depth].outerCount;
+                    live = selections[depth].outerLive;
+                }
+                const double *decider = top - (otherwise ? 2 : 1) * tok::BLOCK_SIZE;
+                bool wanted = op != tok::OPCODE::LOR && !otherwise;
+                if (depth == selections.size())
+                    selections.emplace_back();
+                Selection &selection = selections[depth++];
+                selection.owner = owner;
+                selection.outerCount = n;
+                selection.outerLive = live;
+                std::size_t count = 0;
+                for (std::size_t r = 0; r < n; r++)
+                {
+                    if (tok::isTrue(decider[r]) == wanted)
+                        selection.rows[count++] = live ? live[r] : r;
+                }
+                if (count != n || live)
+                    live = selection.rows;
+                n = count;
+                if (n == 0)
+                {
+                    // Skip the operand, leaving a block of no rows in its place.
+                    top += tok::BLOCK_SIZE;
+                    for (i++; i < owner && this->skips[i] != owner; i++)
+                        ;
+                    i--;
+                    continue;
+                }
+            }
+            double *operand = top - tok::BLOCK_SIZE;
+            double *operand1 = top - 2 * tok::BLOCK_SIZE;
+            if (depth != 0 && selections[depth - 1].owner == i)
+            {
+                // The skipped operands are done, merge them into the rows of
+                // the enclosing selection.
+                const Selection &selection = selections[--depth];
+                n = selection.outerCount;
+                live = selection.outerLive;
+                double *decider = ins.op == tok::OPCODE::SELECT ? top - 3 * tok::BLOCK_SIZE : operand1;
+                std::size_t taken = 0, left = 0;
+                for (std::size_t r = 0; r < n; r++)
+                {
+                    if (ins.op == tok::OPCODE::SELECT)
+                        decider[r] = tok::isTrue(decider[r]) ? operand1[taken++] : operand[left++];
+                    else if (tok::isTrue(decider[r]) == (ins.op == tok::OPCODE::LAND))
+                        decider[r] = tok::isTrue(operand[taken++]);
+                    else
+                        decider[r] = ins.op == tok::OPCODE::LOR;
+                }
+                top = decider + tok::BLOCK_SIZE;
+                continue;
+            }
+            switch (ins.op)
+            {
+            case tok::OPCODE::CONST:
+                if (this->typing[i].type == tok::TYPE::INTEGER)
+                    std::fill(top, top + n, tok::pack(tok::integer(this->constants[ins.arg])));
+                else
+                    std::fill(top, top + n, this->constants[ins.arg]);
+                top += tok::BLOCK_SIZE;
+                break;
+            case tok::OPCODE::LOAD:
+                if (live)
+                {
+                    for (std::size_t r = 0; r < n; r++)
+                        top[r] = columns[ins.arg][base + live[r]];
+                }
+                else
+                {
+                    std::copy(columns[ins.arg] + base, columns[ins.arg] + base + n, top);
+                }
+                if (this->typing[i].type == tok::TYPE::INTEGER)
+                    kernels.toInteger(top, n);
+                top += tok::BLOCK_SIZE;
+                break;
+            // The temporaries keep every row in its place, whatever is live.
+            case tok::OPCODE::STORE:
+                if (live)
+                {
+                    for (std::size_t r = 0; r < n; r++)
+                        temporaries[ins.arg * tok::BLOCK_SIZE + live[r]] = operand[r];
+                }
+                else
+                {
+                    std::copy(operand, operand + n, temporaries + ins.arg * tok::BLOCK_SIZE);
+                }
+                break;
+            case tok::OPCODE::RECALL:
+                if (live)
+                {
+                    for (std::size_t r = 0; r < n; r++)
+                        top[r] = temporaries[ins.arg * tok::BLOCK_SIZE + live[r]];
+                }
+                else
+                {
+                    std::copy(temporaries + ins.arg * tok::BLOCK_SIZE, temporaries + ins.arg * tok::BLOCK_SIZE + n, top);
+                }
+                top += tok::BLOCK_SIZE;
+                break;
+            case tok::OPCODE::YIELD:
+                if (live)
+                {
+                    for (std::size_t r = 0; r < n; r++)
+                        outputs[ins.arg][base + live[r]] = operand[r];
+                }
+                else
+                {
+                    std::copy(operand, operand + n, outputs[ins.arg] + base);
+                }
+                break;
+            case tok::OPCODE::DROP:
+                std::copy(operand, operand + n, operand1);
+                top = operand;
+                break;
+            case tok::OPCODE::PLUS:
+                break;
+            case tok::OPCODE::NEG:
+                kernels.neg(operand, n);
+                break;
+            case tok::OPCODE::LNOT:
+                kernels.lnot(operand, n);
+                break;
+            // The result of a binary operation replaces its leftmost operand:
+            case tok::OPCODE::ADD:
+                kernels.add(operand1, operand, n);
+                top = operand;
+                break;
+            case tok::OPCODE::SUB:
+                kernels.sub(operand1, operand, n);
+                top = operand;
+                break;
+            case tok::OPCODE::MUL:
+                kernels.mul(operand1, operand, n);
+                top = operand;
+                break;
+            case tok::OPCODE::DIV:
+                kernels.div(operand1, operand, n);
+                top = operand;
+                break;
+            case tok::OPCODE::MOD:
+                if (this->typing[i].type == tok::TYPE::INTEGER)
+                {
+                    kernels.mod(operand1, operand, n);
+                }
+                else
+                {
+                    for (std::size_t r = 0; r < n; r++)
+                        operand1[r] = tok::remainder(tok::unpack(operand1[r]), tok::unpack(operand[r]));
+                }
+                top = operand;
+                break;
+            case tok::OPCODE::BAND:
+                kernels.band(operand1, operand, n);
+                top = operand;
+                break;
+            case tok::OPCODE::BOR:
+                kernels.bor(operand1, operand, n);
+                top = operand;
+                break;
+            case tok::OPCODE::LAND:
+                kernels.land(operand1, operand, n);
+                top = operand;
+                break;
+            case tok::OPCODE::LOR:
+                kernels.lor(operand1, operand, n);
+                top = operand;
+                break;
+            // Unless its arms were skippable:
+            case tok::OPCODE::SELECT:
+            {
+                double *condition = top - 3 * tok::BLOCK_SIZE;
+                for (std::size_t r = 0; r < n; r++)
+                    condition[r] = tok::isTrue(condition[r]) ? operand1[r] : operand[r];
+                top = operand1;
+                break;
+            }
+            case tok::OPCODE::CALL:
+            {
+                const tok::FunctionEntry &function = tok::function(ins.arg);
+                double *first = top - ins.aux * tok::BLOCK_SIZE;
+                if (function.batch)
+                {
+                    function.batch(first, tok::BLOCK_SIZE, n);
+                }
+                else
+                {
+                    double arguments[tok::MAX_ARITY];
+                    for (std::size_t r = 0; r < n; r++)
+                    {
+                        for (unsigned i = 0; i < ins.aux; i++)
+                            arguments[i] = first[i * tok::BLOCK_SIZE + r];
+                        first[r] = function.scalar(arguments);
+                    }
+                }
+                top = first + tok::BLOCK_SIZE;
+                break;
+            }
+            }
+        }
+        // The result is REAL:
+        if (this->typing.back().type != this->typing.back().consumed)
+            kernels.toReal(stack.data(), n);
+        std::copy(stack.data(), stack.data() + n, out + base);
+    }
+}
+void tok::CompiledExpression::run(const double *const *columns, std::size_t rows, double *out, double *const *outputs, tok::ThreadPool &pool) const
+{
+    // Thrown here rather than on the threads of the pool.
+    needOutputs(*this, outputs);
+    std::size_t chunks = (rows + tok::CHUNK_SIZE - 1) / tok::CHUNK_SIZE;
+    pool.parallelFor(chunks, [&](std::size_t chunk) {
+        std::size_t base = chunk * tok::CHUNK_SIZE;
+        thread_local std::vector<const double *> offset;
+        offset.resize(this->symbols.size());
+        for (std::size_t slot = 0; slot < offset.size(); slot++)
+            offset[slot] = columns[slot] + base;
+        thread_local std::vector<double *> outputOffset;
+        outputOffset.resize(outputs ? this->outputs : 0);
+        for (std::size_t k = 0; k < outputOffset.size(); k++)
+            outputOffset[k] = outputs[k] + base;
+        this->run(offset.data(), std::min(tok::CHUNK_SIZE, rows - base), out + base, outputs ? outputOffset.data() : nullptr);
+    });
+}
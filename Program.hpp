@@ -0,0 +1,459 @@
+#pragma once
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include "Kernels.hpp"
+
+namespace tok
+{
+    /**
+     * The operations a compiled expression consists of. Every operator token
+     * resolves to exactly one of these when the expression is compiled.
+     **/
+    enum class OPCODE : std::uint8_t
+    {
+        CONST, // Push the constant with the given index.
+        LOAD,  // Push the binding in the given slot.
+        PLUS,  // Unary +
+        NEG,   // Unary -
+        LNOT,  // !
+        ADD,   // +
+        SUB,   // -
+        MUL,   // *
+        DIV,   // /
+        MOD,   // %
+        BAND,  // &
+        BOR,   // |
+        LAND,  // &&
+        LOR,   // ||
+        STORE, // Copy the topmost value into the given temporary.
+        RECALL, // Push the given temporary.
+        CALL,   // Replace the arguments with the result of the given function.
+        SELECT, // ?: the second operand if the first is true, else the third.
+        YIELD,  // Copy the topmost value into the given output.
+        DROP    // Drop the value below the topmost one.
+    };
+    /**
+     * The number of opcodes above.
+     **/
+    const std::size_t OPCODES = (std::size_t)OPCODE::DROP + 1;
+    /**
+     * The name of the opcode for diagnostics.
+     **/
+    inline const char *name(OPCODE op)
+    {
+        static const char *const names[] = {"CONST", "LOAD", "PLUS", "NEG", "LNOT", "ADD", "SUB", "MUL",
+                                            "DIV", "MOD", "BAND", "BOR", "LAND", "LOR", "STORE", "RECALL", "CALL", "SELECT",
+                                            "YIELD", "DROP"};
+        return names[(std::size_t)op];
+    }
+    /**
+     * The number of rows the batch evaluation runs every instruction over at
+     * once. Small enough that the operand blocks stay in the L1 cache.
+     **/
+    const std::size_t BLOCK_SIZE = 256;
+    /**
+     * The number of rows one task of the parallel batch evaluation covers.
+     * The input and output of a few columns still fit into the L2 cache.
+     **/
+    const std::size_t CHUNK_SIZE = 16 * BLOCK_SIZE;
+    /**
+     * One entry of the flat postfix program, packed into 8 bytes so that the
+     * whole program is a single contiguous array.
+     **/
+    struct Instruction
+    {
+        OPCODE op;
+        std::uint8_t reserved = 0;
+        // The number of arguments for OPCODE::CALL.
+        std::uint16_t aux = 0;
+        // The constant index for OPCODE::CONST, the slot for OPCODE::LOAD, the
+        // temporary for OPCODE::STORE and OPCODE::RECALL, the function for
+        // OPCODE::CALL and the output for OPCODE::YIELD.
+        std::uint32_t arg = 0;
+    };
+    static_assert(sizeof(Instruction) == 8, "Instructions have to stay packed");
+    /**
+     * The number of values the operation takes off the stack.
+     **/
+    inline int operands(OPCODE op)
+    {
+        switch (op)
+        {
+        case OPCODE::CONST:
+        case OPCODE::LOAD:
+        case OPCODE::RECALL:
+            return 0;
+        case OPCODE::STORE:
+        case OPCODE::YIELD:
+        case OPCODE::PLUS:
+        case OPCODE::NEG:
+        case OPCODE::LNOT:
+            return 1;
+        case OPCODE::SELECT:
+            return 3;
+        default:
+            return 2;
+        }
+    }
+    inline int operands(const Instruction &ins)
+    {
+        return ins.op == OPCODE::CALL ? ins.aux : operands(ins.op);
+    }
+    /**
+     * Apply the operation to its operands with the same semantics run() has.
+     * Unary operations ignore the second operand.
+     **/
+    inline double apply(OPCODE op, double operand1, double operand2)
+    {
+        switch (op)
+        {
+        case OPCODE::NEG:
+            return -operand1;
+        case OPCODE::LNOT:
+            return tok::lnot(operand1);
+        case OPCODE::ADD:
+            return operand1 + operand2;
+        case OPCODE::SUB:
+            return operand1 - operand2;
+        case OPCODE::MUL:
+            return operand1 * operand2;
+        case OPCODE::DIV:
+            return operand1 / operand2;
+        case OPCODE::MOD:
+            return tok::mod(operand1, operand2);
+        case OPCODE::BAND:
+            return tok::band(operand1, operand2);
+        case OPCODE::BOR:
+            return tok::bor(operand1, operand2);
+        case OPCODE::LAND:
+            return tok::land(operand1, operand2);
+        case OPCODE::LOR:
+            return tok::lor(operand1, operand2);
+        case OPCODE::DROP:
+            return operand2;
+        default:
+            return operand1;
+        }
+    }
+    /**
+     * The types values are held in while running. An integer travels in the
+     * 8 bytes of a double, see tok::pack.
+     **/
+    enum class TYPE : std::uint8_t
+    {
+        REAL,   // A double.
+        INTEGER // An int64_t, exact over its whole range.
+    };
+    inline const char *name(TYPE type)
+    {
+        return type == TYPE::INTEGER ? "INTEGER" : "REAL";
+    }
+    /**
+     * The type of the value an instruction leaves behind and the type the
+     * instruction taking it off the stack wants it in. Where they differ, the
+     * value is converted right behind the instruction.
+     **/
+    struct Typing
+    {
+        TYPE type;
+        TYPE consumed;
+    };
+    /**
+     * The type of the result of an operation, given the constant a MOD
+     * divides by or nullptr if its divisor is not a constant. Only meant for
+     * the operations that compute a value: the type of a constant, a binding,
+     * a unary plus or a temporary depends on where it is used.
+     **/
+    tok::TYPE resultType(tok::OPCODE op, const double *divisor);
+    /**
+     * Infer the type of every value of the program. %, & and | take integers,
+     * & and | give one, and so does % by a constant other than 0. Constants
+     * and bindings are taken in the type they are wanted in right away and
+     * temporaries keep the type of what was stored. Everything else is REAL.
+     * Literals and bindings are doubles, so the integers they stand for are
+     * exact up to 2^53, only the results of %, & and | have all 64 bits.
+     **/
+    std::vector<tok::Typing> inferTypes(const std::vector<tok::Instruction> &program, const std::vector<double> &constants);
+    /**
+     * One entry of the threaded code the interpreter runs: the address of the
+     * code handling it, followed by its operands. Superinstructions fused from
+     * a common sequence of instructions use both of them.
+     **/
+    struct ThreadedInstruction
+    {
+        const void *handler;
+        std::uint32_t arg = 0;
+        std::uint32_t arg2 = 0;
+    };
+    /**
+     * Stack depths up to this are evaluated in a buffer on the C++ stack.
+     **/
+    const std::size_t LOCAL_STACK_SIZE = 64;
+    const std::uint32_t NO_SKIP = UINT32_MAX;
+    /**
+     * Maps every variable name of an expression to the integer slot its value
+     * is read from. Names are resolved once while tokenizing, so evaluation
+     * only ever sees slot indices.
+     **/
+    struct SymbolTable
+    {
+    private:
+        // A deque never moves its elements, so the keys can view into it.
+        std::deque<std::string> names;
+        std::unordered_map<std::string_view, unsigned> slots;
+
+    public:
+        SymbolTable() = default;
+        SymbolTable(SymbolTable &&) = default;
+        SymbolTable &operator=(SymbolTable &&) = default;
+        SymbolTable(const SymbolTable &other)
+        {
+            for (const std::string &name : other.names)
+                this->resolve(name);
+        }
+        SymbolTable &operator=(const SymbolTable &other)
+        {
+            if (this != &other)
+            {
+                this->names.clear();
+                this->slots.clear();
+                for (const std::string &name : other.names)
+                    this->resolve(name);
+            }
+            return *this;
+        }
+        /**
+         * Return the slot of the variable, assigning the next free one if the
+         * name has not been seen before. Only a new name is copied.
+         **/
+        unsigned resolve(std::string_view name)
+        {
+            auto it = this->slots.find(name);
+            if (it != this->slots.end())
+                return it->second;
+            this->names.emplace_back(name);
+            return this->slots.emplace(this->names.back(), this->names.size() - 1).first->second;
+        }
+        /**
+         * Return the slot of the variable or -1 if there is no such variable.
+         **/
+        inline int find(std::string_view name) const
+        {
+            auto it = this->slots.find(name);
+            return it == this->slots.end() ? -1 : (int)it->second;
+        }
+        inline const std::string &getName(unsigned slot) const
+        {
+            return this->names.at(slot);
+        }
+        inline std::size_t size() const
+        {
+            return this->names.size();
+        }
+    };
+    /**
+     * An expression that has been tokenized and converted to postfix once and
+     * can be evaluated any number of times afterwards without parsing again.
+     **/
+    struct ExpressionGraph;
+    struct JitState;
+    struct ThreadPool;
+    struct CompiledExpression
+    {
+    private:
+        friend struct tok::ExpressionGraph;
+        std::vector<tok::Instruction> program;
+        std::vector<double> constants;
+        // The source position of every instruction, only used for diagnostics.
+        std::vector<unsigned> positions;
+        tok::SymbolTable symbols;
+        // The deepest the stack gets while running the program.
+        std::size_t maxDepth = 0;
+        // The number of temporaries shared sub-expressions are kept in.
+        std::size_t temporaries = 0;
+        // The number of nodes common subexpression elimination removed.
+        std::size_t eliminated = 0;
+        // The number of values the program yields besides its result.
+        std::size_t outputs = 0;
+        // Counts the runs and holds the native code once there is some. Shared
+        // by the copies of the program, which all run the same instructions.
+        std::shared_ptr<tok::JitState> jit;
+        // The program as the interpreter runs it.
+        std::vector<tok::ThreadedInstruction> threaded;
+        // For every instruction the LAND, LOR or SELECT whose skipped operand
+        // starts there, or NO_SKIP. Those operands only run on the rows that
+        // need them.
+        std::vector<std::uint32_t> skips;
+        // The type of every value, see tok::inferTypes.
+        std::vector<tok::Typing> typing;
+
+        /**
+         * Check that every operation finds its operands and that exactly one
+         * value is left, recording the stack depth on the way. Throws
+         * std::invalid_argument at the first instruction that is missing one.
+         **/
+        void verify();
+
+    public:
+        CompiledExpression() = default;
+        CompiledExpression(std::vector<tok::Instruction> program, std::vector<double> constants, std::vector<unsigned> positions, tok::SymbolTable symbols)
+            : program(std::move(program)), constants(std::move(constants)), positions(std::move(positions)), symbols(std::move(symbols))
+        {
+            this->verify();
+            this->thread(true);
+        }
+        inline const std::vector<tok::Instruction> &getProgram() const
+        {
+            return this->program;
+        }
+        inline const std::vector<double> &getConstants() const
+        {
+            return this->constants;
+        }
+        /**
+         * Return the position in the source the instruction was compiled from.
+         **/
+        inline unsigned getPosition(std::size_t instruction) const
+        {
+            return this->positions.at(instruction);
+        }
+        inline const tok::SymbolTable &getSymbols() const
+        {
+            return this->symbols;
+        }
+        inline std::size_t size() const
+        {
+            return this->program.size();
+        }
+        inline std::size_t getMaxDepth() const
+        {
+            return this->maxDepth;
+        }
+        inline std::size_t getTemporaries() const
+        {
+            return this->temporaries;
+        }
+        inline std::size_t getEliminated() const
+        {
+            return this->eliminated;
+        }
+        inline std::size_t getOutputs() const
+        {
+            return this->outputs;
+        }
+        inline const std::vector<tok::Typing> &getTyping() const
+        {
+            return this->typing;
+        }
+        /**
+         * Translate the program into the threaded code run() executes. With
+         * fuse, common sequences of instructions like LOAD LOAD ADD become a
+         * single superinstruction that is dispatched only once. The right
+         * operand of && and || and the arms of ?: are jumped over when the
+         * left operand or the condition already decides the result.
+         **/
+        void thread(bool fuse);
+        /**
+         * Compile the program to native code once it has evaluated the given
+         * number of rows. A threshold of 0 turns the JIT off again.
+         **/
+        void enableJit(std::uint64_t threshold);
+        /**
+         * Whether the program runs native code by now.
+         **/
+        bool isJitted() const;
+        /**
+         * Arrange the named values in slot order, ready to be passed to run().
+         * Throws std::invalid_argument if a variable has no value.
+         **/
+        std::vector<double> bind(const std::unordered_map<std::string, double> &values) const;
+        /**
+         * Evaluate the compiled program. The bindings hold one value per slot
+         * of the symbol table, so they may only be omitted if the expression
+         * has no variables. Throws std::invalid_argument if the program
+         * yields values, those need the overload with outputs.
+         **/
+        inline double run(const double *bindings) const
+        {
+            return this->run(bindings, nullptr);
+        }
+        inline double run(const std::vector<double> &bindings) const
+        {
+            return this->run(bindings.data());
+        }
+        /**
+         * Evaluate the compiled program, writing the values it yields to the
+         * outputs, which need room for getOutputs() of them.
+         **/
+        double run(const double *bindings, double *outputs) const;
+        double run() const;
+        /**
+         * Evaluate the compiled program for a whole table at once. The columns
+         * hold one array of rows per slot of the symbol table and the result of
+         * every row is written to out. Each instruction is executed over a block
+         * of BLOCK_SIZE rows before moving on to the next one. Throws like
+         * run(bindings) if the program yields values.
+         **/
+        inline void run(const double *const *columns, std::size_t rows, double *out) const
+        {
+            this->run(columns, rows, out, (double *const *)nullptr);
+        }
+        /**
+         * The same, writing every row of the k-th value the program yields to
+         * outputs[k] as well.
+         **/
+        void run(const double *const *columns, std::size_t rows, double *out, double *const *outputs) const;
+        /**
+         * Evaluate the compiled program for a whole table like above, split
+         * into chunks of CHUNK_SIZE rows that the threads of the pool take
+         * turns on. Every row is computed the same way on whichever thread,
+         * so the output does not depend on the schedule.
+         **/
+        inline void run(const double *const *columns, std::size_t rows, double *out, tok::ThreadPool &pool) const
+        {
+            this->run(columns, rows, out, nullptr, pool);
+        }
+        void run(const double *const *columns, std::size_t rows, double *out, double *const *outputs, tok::ThreadPool &pool) const;
+    };
+    /**
+     * Switches for the passes compile() runs between parsing and evaluation.
+     **/
+    struct CompileOptions
+    {
+        // Fold constant sub-expressions and apply the exact algebraic identities.
+        bool optimize = true;
+        // Compute every repeated sub-expression only once (needs optimize).
+        bool cse = true;
+        // Also apply identities that only hold without NaN, infinities and
+        // negative zero, like x+0 = x and x*0 = 0.
+        bool finiteMath = false;
+        // Generate native code after this many evaluated rows, 0 never does.
+        std::uint64_t jitThreshold = 10000;
+        // Fuse common sequences of instructions into superinstructions.
+        bool superinstructions = true;
+    };
+    tok::CompiledExpression compile(std::string_view, const tok::CompileOptions & = tok::CompileOptions());
+    /**
+     * Compile a whole set of expressions into a single program that yields
+     * the value of the k-th expression into output k, the last one being the
+     * result as well. The expressions share their variables, and with
+     * CompileOptions::cse every sub-expression they have in common is
+     * computed only once per row.
+     **/
+    tok::CompiledExpression compile(const std::vector<std::string_view> &, const tok::CompileOptions & = tok::CompileOptions());
+    /**
+     * List every instruction with the type of its value and where it is
+     * converted, one per line, for debugging.
+     **/
+    std::string typeReport(const tok::CompiledExpression &);
+}
+
+#endif
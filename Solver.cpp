@@ -1,17 +1,29 @@
+#include <charconv>
+#include <stdexcept>
 #include "Token.hpp"
+#include "Cache.hpp"
+#include "Trace.hpp"
+#include "Functions.hpp"
 // Reverse a list of tokens:
 /**
  * Evaluate the value of an expression contained in the string parameter.
  **/
-double tok::eval(std::string expr)
+double tok::eval(std::string_view expr)
 {
-    std::vector<tok::Token *> tokens = tokenization(expr);
-    print(tokens);
-    tokens = infixtopostfix(tokens);
-    return evaluate(tokens);
+    return tok::cache().get(expr)->run();
+}
+/**
+ * Evaluate the expression with the variables bound to the given values.
+ **/
+double tok::eval(std::string_view expr, const std::unordered_map<std::string, double> &values)
+{
+    std::shared_ptr<const tok::CompiledExpression> program = tok::cache().get(expr);
+    return program->run(program->bind(values));
 }
 // TODO: Replace with match method utilizing the individual match methods of the individual classes.
-std::vector<tok::Token *> tok::tokenization(std::string expr)
+// Tokenize the expression, resolving every variable to its slot in the symbol table.
+// The tokens are owned by the arena and released with its next reset.
+std::vector<tok::Token *> tok::tokenization(std::string_view expr, tok::SymbolTable &symbols, tok::Arena &arena)
 {
     std::vector<tok::Token *> tokens{};
     unsigned len = expr.length();
@@ -20,75 +32,80 @@ std::vector<tok::Token *> tok::tokenization(std::string expr)
         switch (expr.at(i))
         {
         case '&':
-            if (tok::lookup("&&", expr, i, tokens))
+            if (tok::lookup("&&", expr, i))
             {
-                (new tok::LAND("&&", i))->consume(tokens);
-                std::cout << "!" << std::endl;
+                arena.make<tok::LAND>("&&", i)->consume(tokens);
                 i++;
             }
             else
             {
-                (new tok::BAND("&", i))->consume(tokens);
+                arena.make<tok::BAND>("&", i)->consume(tokens);
             }
 
             break;
         case '%':
-            (new tok::MOD("%", i))->consume(tokens);
+            arena.make<tok::MOD>("%", i)->consume(tokens);
         break;
         case '|':
-            if (tok::lookup("||", expr, i, tokens))
+            if (tok::lookup("||", expr, i))
             {
-                (new tok::LOR("||", i))->consume(tokens);
+                arena.make<tok::LOR>("||", i)->consume(tokens);
                 i++;
             }
             else
             {
-                (new tok::BOR("|", i))->consume(tokens);
+                arena.make<tok::BOR>("|", i)->consume(tokens);
             }
 
             break;
         case '!':
-            (new tok::LNOT("!", i))->consume(tokens);
+            arena.make<tok::LNOT>("!", i)->consume(tokens);
             break;
         case '*':
-            (new tok::MULT("*", i))->consume(tokens);
+            arena.make<tok::MULT>("*", i)->consume(tokens);
             break;
         case '/':
-            (new tok::DIV("/", i))->consume(tokens);
+            arena.make<tok::DIV>("/", i)->consume(tokens);
             break;
         case '+':
-            if (i == 0 || (tokens.size() != 0 && (tokens.back()->isBinaryOperation() || tokens.back()->isLeftParen())))
+            if (tokens.size() == 0 || tokens.back()->isBinaryOperation() || tokens.back()->isUnaryOperation() || tokens.back()->isLeftParen() || tokens.back()->isComma() || tokens.back()->isTernaryOperation())
             {
-                (new tok::UNADD("+", i))->consume(tokens);
+                arena.make<tok::UNADD>("+", i)->consume(tokens);
             }
             else
             {
-                (new tok::BINADD("+", i))->consume(tokens);
+                arena.make<tok::BINADD>("+", i)->consume(tokens);
             }
 
             break;
         case '-':
-            if (i == 0 || (tokens.size() != 0 && (tokens.back()->isBinaryOperation() || tokens.back()->isLeftParen())))
+            if (tokens.size() == 0 || tokens.back()->isBinaryOperation() || tokens.back()->isUnaryOperation() || tokens.back()->isLeftParen() || tokens.back()->isComma() || tokens.back()->isTernaryOperation())
             {
-                (new tok::UNSUB("-", i))->consume(tokens);
+                arena.make<tok::UNSUB>("-", i)->consume(tokens);
             }
             else
             {
-                (new tok::BINSUB("-", i))->consume(tokens);
+                arena.make<tok::BINSUB>("-", i)->consume(tokens);
             }
             break;
         case ',':
-            (new tok::Comma(",", i))->consume(tokens);
+            arena.make<tok::Comma>(",", i)->consume(tokens);
+            break;
+        case '?':
+            arena.make<tok::TERNARY>("?", i)->consume(tokens);
+            break;
+        case ':':
+            arena.make<tok::COLON>(":", i)->consume(tokens);
             break;
         case '(':
         case '[':
         case '{':
-            (new tok::LPAREN("(", i))->consume(tokens);
+            arena.make<tok::LPAREN>("(", i)->consume(tokens);
             break;
         case ')':
         case '}':
         case ']':
-            (new tok::RPAREN(")", i))->consume(tokens);
+            arena.make<tok::RPAREN>(")", i)->consume(tokens);
             break;
         case ' ':
         case '\r':
@@ -97,29 +114,29 @@ std::vector<tok::Token *> tok::tokenization(std::string expr)
             break;
         case '_':
             // Can be the start of a variable:
-            i = consumeVar(expr, i, tokens);
+            i = consumeVar(expr, i, tokens, symbols, arena);
             break;
         case '.':
             // Can be the start of a floating point literal.
             // \d*.?\d*e-?\d+ for ieee numbers.
-            i = consumeLit(expr, i, tokens);
+            i = consumeLit(expr, i, tokens, arena);
+            break;
+        case '0':
+            // Might be a normal literal, but if it is followed by an x it is a hex number, or if it is followed by a normal digit it is an octal number.
+            i = consumeLit(expr, i, tokens, arena);
             break;
-        //case '0':
-        // Might be a normal literal, but if it is followed by an x it is a hex digit, or if it is followed by a normal non-zero digit it is an oktal number.
-        // TODO!
-        //break;
         default:
             if (isLetter(expr.at(i)))
             {
-                i = consumeVar(expr, i, tokens);
+                i = consumeVar(expr, i, tokens, symbols, arena);
             }
             else if (isDigit(expr.at(i)))
             {
-                i = consumeLit(expr, i, tokens);
+                i = consumeLit(expr, i, tokens, arena);
             }
             else
             {
-                std::cout << "There is no such token!" << std::endl;
+                TOK_LOG("Skipping " << expr.at(i) << " at " << i << ", there is no such token");
             }
             break;
         }
@@ -173,15 +190,29 @@ std::vector<tok::Token *> tok::infixtopostfixO(std::vector<tok::Token *> tokens)
             // Left parenthesis:
             operators.push_front(tok);
         }
+        else if (tok->isFunction())
+        {
+            // The arguments are counted from here on:
+            tok->setOperands(1);
+            operators.push_front(tok);
+        }
+        else if (tok->isComma())
+        {
+            tok::nextArgument(tok, posfix, operators);
+        }
+        else if (tok->isTernaryOperation() && tok->getOpcode() == tok::OPCODE::SELECT)
+        {
+            tok->setOperands(2);
+            tok::openTernary(tok, posfix, operators);
+        }
+        else if (tok->isTernaryOperation())
+        {
+            tok::closeTernary(tok, posfix, operators);
+        }
         else if (tok->isRightParen())
         {
             // Right parenthesis:
-            while (!(operators.front()->isLeftParen()))
-            {
-                posfix.push_back(operators.front());
-                operators.pop_front();
-            }
-            operators.pop_front();
+            tok::closeParen(tok, &tok != tokens.data() && (&tok)[-1]->isLeftParen(), posfix, operators);
         }
         else
         {
@@ -196,21 +227,19 @@ std::vector<tok::Token *> tok::infixtopostfixO(std::vector<tok::Token *> tokens)
     }
     return posfix;
 }
+// Evaluate a postfix token list. The variables are not bound to anything
+// here, so expressions with variables have to go through compile() instead.
 double tok::evaluate(std::vector<tok::Token *> rpn)
 { // http://www-stone.ch.cam.ac.uk/documentation/rrf/rpn.html
-    std::deque<double> stack;
-    std::reverse(rpn.begin(), rpn.end());
-    double operand1, operand2;
-    while (!rpn.empty())
+    tok::SymbolTable symbols;
+    for (tok::Token *&tok : rpn)
     {
-
-            stack.push_front(rpn.back()->evaluate(stack));
-            rpn.pop_back();
-        
+        if (tok->getOpcode() == tok::OPCODE::LOAD)
+            symbols.resolve(tok->getValue());
     }
-    return stack.front();
+    return assemble(rpn, std::move(symbols)).run();
 }
-unsigned tok::consumeVar(std::string expr, unsigned pos, std::vector<tok::Token *> &tokens)
+unsigned tok::consumeVar(std::string_view expr, unsigned pos, std::vector<tok::Token *> &tokens, tok::SymbolTable &symbols, tok::Arena &arena)
 {
     unsigned long long skip = pos;
     for (unsigned itr = pos; (expr.length() != itr) && (isLetter(expr.at(itr)) || (expr.at(itr) == '_') || (isDigit(expr.at(itr)))); itr++)
@@ -219,26 +248,73 @@ unsigned tok::consumeVar(std::string expr, unsigned pos, std::vector<tok::Token
     }
     if ((expr.size() != skip) && (expr.at(skip) == '('))
     {
-        // It is a function: (only two operands right now)
-        (new tok::Function{expr.substr(pos, skip - pos), pos})->consume(tokens);
+        // It is a function, resolved to its entry in the registry right away:
+        std::string_view name = expr.substr(pos, skip - pos);
+        int function = tok::findFunction(name);
+        if (function < 0)
+            throw std::invalid_argument("Unknown function " + std::string(name) + " at " + std::to_string(pos));
+        arena.make<tok::Function>(name, pos, function)->consume(tokens);
     }
     else
     {
         // It is a variable:
-        (new tok::VARIABLE{expr.substr(pos, skip - pos), pos})->consume(tokens);
+        std::string_view name = expr.substr(pos, skip - pos);
+        unsigned slot = symbols.resolve(name);
+        arena.make<tok::VARIABLE>(name, pos, slot)->consume(tokens);
     }
     return skip - 1;
-    return 1;
 }
-// Check, if the element at pos matches to a literal and if it does,
-unsigned tok::consumeLit(std::string expr, unsigned pos, std::vector<tok::Token *> &tokens)
+// Check, if the element at pos matches to a literal and if it does, convert it
+// to its value right away. Decimal literals may carry an ieee exponent (1e-9),
+// 0x starts a hex literal and a 0 followed by digits an octal one.
+unsigned tok::consumeLit(std::string_view expr, unsigned pos, std::vector<tok::Token *> &tokens, tok::Arena &arena)
 {
     unsigned long long skip = pos;
-    for (unsigned itr = pos; (expr.length() != itr) && (isDigit(expr.at(itr)) || (expr.at(itr) == '.')); itr++)
+    double number = 0.0;
+    const char *first = expr.data() + pos;
+    const char *last = expr.data() + expr.size();
+    std::from_chars_result result{first, std::errc::invalid_argument};
+    if (expr.at(pos) == '0' && expr.size() > pos + 1 && (expr.at(pos + 1) == 'x' || expr.at(pos + 1) == 'X'))
     {
-        skip++;
+        unsigned long long integer = 0;
+        result = std::from_chars(first + 2, last, integer, 16);
+        number = integer;
     }
-    (new tok::Literal{expr.substr(pos, skip - pos), pos})->consume(tokens);
+    else
+    {
+        unsigned long long itr = pos;
+        while (itr != expr.length() && (isDigit(expr.at(itr)) || expr.at(itr) == '.'))
+            itr++;
+        bool octal = expr.at(pos) == '0' && itr - pos > 1 && expr.find('.', pos) >= itr;
+        // An exponent with digits makes a literal like 010e1 decimal. A bare e,
+        // like in 2e or 2ex, does not start the next token: the literal is
+        // rejected as invalid.
+        if (itr != expr.length() && (expr.at(itr) == 'e' || expr.at(itr) == 'E'))
+        {
+            unsigned long long exponent = itr + 1;
+            if (exponent != expr.length() && (expr.at(exponent) == '-' || expr.at(exponent) == '+'))
+                exponent++;
+            if (exponent != expr.length() && isDigit(expr.at(exponent)))
+                octal = false;
+        }
+        if (octal)
+        {
+            unsigned long long integer = 0;
+            result = std::from_chars(first + 1, last, integer, 8);
+            number = integer;
+        }
+        else
+        {
+            result = std::from_chars(first, last, number, std::chars_format::general);
+        }
+    }
+    if (result.ec != std::errc())
+        throw std::invalid_argument("Invalid literal at " + std::to_string(pos));
+    skip = result.ptr - expr.data();
+    // Whatever is left of the literal (09, 1.2.3, 0x1g) makes it malformed:
+    if (skip != expr.length() && (isDigit(expr.at(skip)) || isLetter(expr.at(skip)) || expr.at(skip) == '.' || expr.at(skip) == '_'))
+        throw std::invalid_argument("Invalid literal at " + std::to_string(pos));
+    arena.make<tok::Literal>(expr.substr(pos, skip - pos), pos, number)->consume(tokens);
     return skip - 1;
 }
 // Print the whole list front the element 0 to size-1;
@@ -249,6 +325,13 @@ void tok::print(std::vector<tok::Token *> tokens)
         std::cout << tok->toString() << std::endl;
     }
 }
+std::string tok::toString(const std::vector<tok::Token *> &tokens)
+{
+    std::string text;
+    for (tok::Token *tok : tokens)
+        text += (text.empty() ? "" : ", ") + tok->toString();
+    return text;
+}
 void tok::print(std::deque<tok::Token *> tokens)
 {
     for (tok::Token *&tok : tokens)
@@ -256,8 +339,8 @@ void tok::print(std::deque<tok::Token *> tokens)
         std::cout << tok->toString() << std::endl;
     }
 }
-inline bool tok::lookup(std::string match, std::string expr, int pos, std::vector<tok::Token *> &tokens)
+inline bool tok::lookup(std::string_view match, std::string_view expr, int pos)
 {
-    std::string str = expr.substr(pos, match.size());
+    std::string_view str = expr.substr(pos, match.size());
     return !match.compare(str);
 }
\ No newline at end of file
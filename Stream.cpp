@@ -0,0 +1,330 @@
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include "Stream.hpp"
+#include "Cache.hpp"
+
+void tok::BufferedWriter::write(std::string_view text)
+{
+    if (this->used + text.size() > this->buffer.size())
+    {
+        this->flush();
+        if (text.size() > this->buffer.size())
+            this->buffer.resize(text.size());
+    }
+    std::memcpy(this->buffer.data() + this->used, text.data(), text.size());
+    this->used += text.size();
+}
+void tok::BufferedWriter::flush()
+{
+    std::size_t written = 0;
+    while (written < this->used)
+    {
+        ssize_t n = ::write(this->fd, this->buffer.data() + written, this->used - written);
+        if (n <= 0)
+            break;
+        written += n;
+    }
+    this->used = 0;
+}
+tok::MappedFile::MappedFile(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open " + path);
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("Cannot read " + path);
+    }
+    if (!S_ISREG(info.st_mode))
+    {
+        char chunk[65536];
+        ssize_t n;
+        while ((n = read(fd, chunk, sizeof(chunk))) > 0)
+            this->buffer.append(chunk, n);
+        close(fd);
+        if (n < 0)
+            throw std::runtime_error("Cannot read " + path);
+        this->data = this->buffer.data();
+        this->size = this->buffer.size();
+        return;
+    }
+    this->size = info.st_size;
+    if (this->size != 0)
+    {
+        void *memory = mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (memory == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error("Cannot map " + path);
+        }
+        madvise(memory, this->size, MADV_SEQUENTIAL);
+        this->data = (const char *)memory;
+        this->mapped = true;
+    }
+    close(fd);
+}
+tok::MappedFile::~MappedFile()
+{
+    if (this->mapped)
+        munmap((void *)this->data, this->size);
+}
+namespace
+{
+    struct Bindings
+    {
+        std::unordered_map<std::string, std::size_t> columns;
+        std::vector<std::vector<double>> rows;
+
+        // The values for the given line, or null if there are none.
+        const std::vector<double> *row(std::size_t line) const
+        {
+            if (this->rows.size() == 1)
+                return &this->rows[0];
+            return line < this->rows.size() ? &this->rows[line] : nullptr;
+        }
+    };
+    std::string_view trim(std::string_view text)
+    {
+        while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+            text.remove_prefix(1);
+        while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r'))
+            text.remove_suffix(1);
+        return text;
+    }
+    std::vector<std::string_view> split(std::string_view line, char separator)
+    {
+        std::vector<std::string_view> cells;
+        std::size_t start = 0;
+        while (true)
+        {
+            std::size_t end = line.find(separator, start);
+            cells.push_back(trim(line.substr(start, end == std::string_view::npos ? std::string_view::npos : end - start)));
+            if (end == std::string_view::npos)
+                return cells;
+            start = end + 1;
+        }
+    }
+    Bindings readBindings(const std::string &path)
+    {
+        Bindings bindings;
+        tok::MappedFile file(path);
+        std::string_view text(file.data, file.size);
+        bool header = true;
+        while (!text.empty())
+        {
+            std::size_t end = text.find('\n');
+            std::string_view line = trim(text.substr(0, end));
+            text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+            if (line.empty())
+                continue;
+            std::vector<std::string_view> cells = split(line, ',');
+            if (header)
+            {
+                for (std::size_t column = 0; column < cells.size(); column++)
+                    bindings.columns.emplace(std::string(cells[column]), column);
+                header = false;
+                continue;
+            }
+            std::vector<double> row(cells.size());
+            for (std::size_t column = 0; column < cells.size(); column++)
+            {
+                std::from_chars_result result = std::from_chars(cells[column].data(), cells[column].data() + cells[column].size(), row[column]);
+                if (result.ec != std::errc() || result.ptr != cells[column].data() + cells[column].size())
+                    throw std::invalid_argument("Invalid value " + std::string(cells[column]) + " in " + path);
+            }
+            bindings.rows.push_back(std::move(row));
+        }
+        return bindings;
+    }
+    struct Batch
+    {
+        // The text of the lines, unless they view into a mapped file. Shared
+        // by the batches cut from the same chunk of input.
+        std::shared_ptr<const std::string> storage;
+        std::vector<std::string_view> lines;
+        // The number of lines before this batch.
+        std::size_t first = 0;
+        std::vector<std::shared_ptr<const tok::CompiledExpression>> programs;
+        std::vector<std::string> errors;
+        std::string output;
+        std::size_t failed = 0;
+    };
+    typedef tok::BoundedQueue<std::unique_ptr<Batch>> Queue;
+    // Cut the text into lines, leaving a last line without a newline in text.
+    void cut(std::string_view &text, Batch &batch, std::size_t batchSize)
+    {
+        while (batch.lines.size() < batchSize)
+        {
+            std::size_t end = text.find('\n');
+            if (end == std::string_view::npos)
+                return;
+            std::string_view line = text.substr(0, end);
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            batch.lines.push_back(line);
+            text.remove_prefix(end + 1);
+        }
+    }
+    void readMapped(const tok::MappedFile &file, Queue &queue, std::size_t batchSize)
+    {
+        std::string_view text(file.data, file.size);
+        std::size_t lines = 0;
+        while (!text.empty())
+        {
+            std::unique_ptr<Batch> batch(new Batch);
+            batch->first = lines;
+            cut(text, *batch, batchSize);
+            // The last line may lack its newline:
+            if (batch->lines.size() < batchSize && !text.empty())
+            {
+                batch->lines.push_back(text);
+                text = std::string_view();
+            }
+            lines += batch->lines.size();
+            queue.push(std::move(batch));
+        }
+        queue.close();
+    }
+    void readStdin(Queue &queue, std::size_t batchSize)
+    {
+        const std::size_t CHUNK = 1 << 20;
+        std::string rest;
+        std::size_t lines = 0;
+        bool end = false;
+        while (!end)
+        {
+            std::shared_ptr<std::string> chunk = std::make_shared<std::string>(std::move(rest));
+            std::size_t size = chunk->size();
+            chunk->resize(size + CHUNK);
+            ssize_t n = read(0, &(*chunk)[size], CHUNK);
+            end = n <= 0;
+            chunk->resize(size + std::max<ssize_t>(n, 0));
+            std::string_view text = *chunk;
+            while (true)
+            {
+                std::unique_ptr<Batch> batch(new Batch);
+                batch->storage = chunk;
+                batch->first = lines;
+                cut(text, *batch, batchSize);
+                if (end && !text.empty() && batch->lines.size() < batchSize)
+                {
+                    batch->lines.push_back(text);
+                    text = std::string_view();
+                }
+                if (batch->lines.empty())
+                    break;
+                lines += batch->lines.size();
+                queue.push(std::move(batch));
+            }
+            // A line that continues in the next chunk:
+            rest = std::string(text);
+        }
+        queue.close();
+    }
+    void compile(Queue &in, Queue &out)
+    {
+        std::unique_ptr<Batch> batch;
+        while (in.pop(batch))
+        {
+            batch->programs.resize(batch->lines.size());
+            batch->errors.resize(batch->lines.size());
+            for (std::size_t i = 0; i < batch->lines.size(); i++)
+            {
+                try
+                {
+                    batch->programs[i] = tok::cache().get(batch->lines[i]);
+                }
+                catch (const std::exception &e)
+                {
+                    batch->errors[i] = e.what();
+                }
+            }
+            out.push(std::move(batch));
+        }
+        out.close();
+    }
+    void evaluate(Queue &in, Queue &out, const Bindings &bindings)
+    {
+        std::unique_ptr<Batch> batch;
+        std::vector<double> values;
+        while (in.pop(batch))
+        {
+            batch->output.reserve(batch->lines.size() * 16);
+            for (std::size_t i = 0; i < batch->lines.size(); i++)
+            {
+                if (batch->programs[i] && batch->errors[i].empty())
+                {
+                    const tok::CompiledExpression &program = *batch->programs[i];
+                    const tok::SymbolTable &symbols = program.getSymbols();
+                    const std::vector<double> *row = bindings.row(batch->first + i);
+                    values.resize(symbols.size());
+                    for (std::size_t slot = 0; slot < symbols.size() && batch->errors[i].empty(); slot++)
+                    {
+                        auto column = bindings.columns.find(symbols.getName(slot));
+                        if (!row || column == bindings.columns.end() || column->second >= row->size())
+                            batch->errors[i] = "No value for variable " + symbols.getName(slot);
+                        else
+                            values[slot] = (*row)[column->second];
+                    }
+                    if (batch->errors[i].empty())
+                    {
+                        char text[32];
+                        std::to_chars_result result = std::to_chars(text, text + sizeof(text), program.run(values.data()));
+                        batch->output.append(text, result.ptr);
+                        batch->output.push_back('\n');
+                        continue;
+                    }
+                }
+                batch->failed++;
+                batch->output.append("error: ");
+                batch->output.append(batch->errors[i]);
+                batch->output.push_back('\n');
+            }
+            out.push(std::move(batch));
+        }
+        out.close();
+    }
+}
+std::size_t tok::stream(const tok::StreamOptions &options, int out)
+{
+    Bindings bindings;
+    if (!options.bindings.empty())
+        bindings = readBindings(options.bindings);
+    std::unique_ptr<tok::MappedFile> file;
+    if (!options.input.empty())
+        file.reset(new tok::MappedFile(options.input));
+    Queue lines(8), programs(8), results(8);
+    std::size_t batchSize = std::max<std::size_t>(options.batchSize, 1);
+    std::thread reader([&]() {
+        if (file)
+            readMapped(*file, lines, batchSize);
+        else
+            readStdin(lines, batchSize);
+    });
+    std::thread compiler([&]() { compile(lines, programs); });
+    std::thread evaluator([&]() { evaluate(programs, results, bindings); });
+    std::size_t failed = 0;
+    {
+        tok::BufferedWriter writer(out);
+        std::unique_ptr<Batch> batch;
+        while (results.pop(batch))
+        {
+            writer.write(batch->output);
+            failed += batch->failed;
+        }
+    }
+    reader.join();
+    compiler.join();
+    evaluator.join();
+    return failed;
+}
@@ -0,0 +1,125 @@
+#pragma once
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace tok
+{
+    /**
+     * A queue between two threads that blocks the producer while it is full
+     * and the consumer while it is empty.
+     **/
+    template <typename T>
+    struct BoundedQueue
+    {
+    private:
+        std::mutex lock;
+        std::condition_variable notEmpty;
+        std::condition_variable notFull;
+        std::deque<T> items;
+        std::size_t capacity;
+        bool closed = false;
+
+    public:
+        explicit BoundedQueue(std::size_t capacity) : capacity(capacity)
+        {
+        }
+        void push(T item)
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->notFull.wait(guard, [&]() { return this->items.size() < this->capacity; });
+            this->items.push_back(std::move(item));
+            this->notEmpty.notify_one();
+        }
+        /**
+         * Take the next item, or return false once the queue is closed and
+         * has been drained.
+         **/
+        bool pop(T &item)
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->notEmpty.wait(guard, [&]() { return !this->items.empty() || this->closed; });
+            if (this->items.empty())
+                return false;
+            item = std::move(this->items.front());
+            this->items.pop_front();
+            this->notFull.notify_one();
+            return true;
+        }
+        void close()
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->closed = true;
+            this->notEmpty.notify_all();
+        }
+    };
+    /**
+     * Collects output in one large buffer that is only written to the file
+     * descriptor when it is full or flushed.
+     **/
+    struct BufferedWriter
+    {
+    private:
+        int fd;
+        std::vector<char> buffer;
+        std::size_t used = 0;
+
+    public:
+        explicit BufferedWriter(int fd, std::size_t capacity = 1 << 20) : fd(fd), buffer(capacity)
+        {
+        }
+        BufferedWriter(const BufferedWriter &) = delete;
+        BufferedWriter &operator=(const BufferedWriter &) = delete;
+        ~BufferedWriter()
+        {
+            this->flush();
+        }
+        void write(std::string_view text);
+        void flush();
+    };
+    /**
+     * A whole file mapped read-only into memory. A pipe, FIFO or device has
+     * no size to map, so it is read to its end into a buffer instead.
+     **/
+    struct MappedFile
+    {
+        const char *data = nullptr;
+        std::size_t size = 0;
+        // Holds what was read when the file could not be mapped.
+        std::string buffer;
+        bool mapped = false;
+
+        explicit MappedFile(const std::string &path);
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+        ~MappedFile();
+    };
+    struct StreamOptions
+    {
+        // The file of expressions, one per line. Read from stdin if empty.
+        std::string input;
+        // A CSV file with the variable names in its header. Its n-th row binds
+        // the n-th expression, or every expression if it has only one row.
+        std::string bindings;
+        // The number of lines handed from one stage to the next at once.
+        std::size_t batchSize = 4096;
+    };
+    /**
+     * Evaluate a stream of newline-delimited expressions. Reading, compiling
+     * and evaluating run on threads of their own with batches of lines queued
+     * between them, while the calling thread writes one line per expression
+     * to the file descriptor: the result, or "error: " and the reason.
+     * Regular files are mapped into memory rather than read. Returns the
+     * number of expressions that failed.
+     **/
+    std::size_t stream(const tok::StreamOptions &options, int out = 1);
+}
+
+#endif
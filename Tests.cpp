@@ -0,0 +1,1034 @@
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "Arena.hpp"
+#include "Binary.hpp"
+#include "Cache.hpp"
+#include "Functions.hpp"
+#include "Jit.hpp"
+#include "Kernels.hpp"
+#include "Stream.hpp"
+#include "ThreadPool.hpp"
+#include "Token.hpp"
+#include "Trace.hpp"
+#include "Workbook.hpp"
+
+using namespace std;
+
+namespace
+{
+    size_t checks = 0;
+    size_t failures = 0;
+
+    void check(bool ok, const string &what)
+    {
+        checks++;
+        if (ok)
+            return;
+        failures++;
+        if (failures <= 20)
+            cerr << "FAILED: " << what << endl;
+    }
+    bool sameBits(double a, double b)
+    {
+        return memcmp(&a, &b, sizeof(double)) == 0;
+    }
+    string show(double value)
+    {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        char hex[32];
+        snprintf(hex, sizeof(hex), " (0x%016llx)", (unsigned long long)bits);
+        return to_string(value) + hex;
+    }
+
+    const double NaN = numeric_limits<double>::quiet_NaN();
+    const double INF = numeric_limits<double>::infinity();
+    // The doubles every kernel has to agree on, including the ones outside
+    // the range of int32 and int64.
+    const vector<double> REALS = {NaN, -NaN, 0.0, -0.0, INF, -INF, 1.0, -1.0, 0.5, -2.5, 3.0, 7.75, -7.75,
+                                  1e300, -1e300, 4.9e-324, 2147483647.0, 2147483648.0, -2147483648.0,
+                                  -2147483649.0, 9.3e18, -9.3e18, 0x1p63, -0x1p63, 0x1p53 + 2, -123456789.0};
+    // The same for the packed integers of %, & and |.
+    const vector<int64_t> INTEGERS = {0, 1, -1, 2, -2, 7, -7, 255, INT32_MAX, INT32_MIN, (int64_t)INT32_MAX + 1,
+                                      (int64_t)INT32_MIN - 1, INT64_MAX, INT64_MIN, INT64_MIN + 1,
+                                      (int64_t)1 << 53, -((int64_t)1 << 40) - 3, 1000000007};
+    // Lengths around every vector width, so that every tail is covered.
+    const size_t LENGTHS[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 64, 65, 257};
+
+    vector<double> reals(size_t n, size_t seed)
+    {
+        vector<double> values(n);
+        for (size_t i = 0; i < n; i++)
+            values[i] = REALS[(i * 7 + seed) % REALS.size()];
+        return values;
+    }
+    // Packed integers, all of them fit into int32 if narrow, so that the
+    // int32 shortcuts of the vector kernels are taken as well.
+    vector<double> integers(size_t n, size_t seed, bool narrow, bool divisor)
+    {
+        vector<double> values(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            int64_t value = INTEGERS[(i * 5 + seed) % INTEGERS.size()];
+            if (narrow)
+                value = (int32_t)value % 1000;
+            // The remainder kernel is only given divisors other than 0.
+            if (divisor && value == 0)
+                value = -1;
+            values[i] = tok::pack(value);
+        }
+        return values;
+    }
+    void compare(const string &kernel, const tok::Kernels &variant, const vector<double> &expected, const vector<double> &actual)
+    {
+        for (size_t i = 0; i < expected.size(); i++)
+            check(sameBits(expected[i], actual[i]), string(variant.name) + " " + kernel + " of " + to_string(expected.size()) +
+                                                        " at " + to_string(i) + ": " + show(actual[i]) + " instead of " + show(expected[i]));
+    }
+    void unary(const string &kernel, tok::UnaryKernel tok::Kernels::*member, const tok::Kernels &variant, const vector<double> &input)
+    {
+        const tok::Kernels &scalar = *tok::kernelVariants().front();
+        vector<double> expected = input, actual = input;
+        (scalar.*member)(expected.data(), expected.size());
+        (variant.*member)(actual.data(), actual.size());
+        compare(kernel, variant, expected, actual);
+    }
+    void binary(const string &kernel, tok::BinaryKernel tok::Kernels::*member, const tok::Kernels &variant, const vector<double> &input1,
+                const vector<double> &input2)
+    {
+        const tok::Kernels &scalar = *tok::kernelVariants().front();
+        vector<double> expected = input1, actual = input1;
+        (scalar.*member)(expected.data(), input2.data(), expected.size());
+        (variant.*member)(actual.data(), input2.data(), actual.size());
+        compare(kernel, variant, expected, actual);
+    }
+    /**
+     * Every kernel variant the CPU supports against the scalar kernels, bit
+     * for bit.
+     **/
+    void kernels()
+    {
+        for (const tok::Kernels *variant : tok::kernelVariants())
+        {
+            for (size_t n : LENGTHS)
+            {
+                for (size_t seed = 0; seed < 3; seed++)
+                {
+                    vector<double> a = reals(n, seed), b = reals(n, seed + 11);
+                    unary("neg", &tok::Kernels::neg, *variant, a);
+                    unary("lnot", &tok::Kernels::lnot, *variant, a);
+                    unary("toInteger", &tok::Kernels::toInteger, *variant, a);
+                    binary("add", &tok::Kernels::add, *variant, a, b);
+                    binary("sub", &tok::Kernels::sub, *variant, a, b);
+                    binary("mul", &tok::Kernels::mul, *variant, a, b);
+                    binary("div", &tok::Kernels::div, *variant, a, b);
+                    binary("land", &tok::Kernels::land, *variant, a, b);
+                    binary("lor", &tok::Kernels::lor, *variant, a, b);
+                    for (bool narrow : {false, true})
+                    {
+                        vector<double> x = integers(n, seed, narrow, false), y = integers(n, seed + 3, narrow, false);
+                        unary("toReal", &tok::Kernels::toReal, *variant, x);
+                        binary("band", &tok::Kernels::band, *variant, x, y);
+                        binary("bor", &tok::Kernels::bor, *variant, x, y);
+                        binary("mod", &tok::Kernels::mod, *variant, x, integers(n, seed + 3, narrow, true));
+                    }
+                }
+            }
+        }
+        // INT64_MIN % -1 overflows the division, it is 0 everywhere.
+        for (const tok::Kernels *variant : tok::kernelVariants())
+        {
+            vector<double> x(9, tok::pack(INT64_MIN)), y(9, tok::pack(-1));
+            variant->mod(x.data(), y.data(), x.size());
+            for (double value : x)
+                check(tok::unpack(value) == 0, string(variant->name) + " INT64_MIN % -1");
+        }
+    }
+    /**
+     * The batch implementation of every built-in function against its scalar
+     * one, and the signed zeros of min, max and clamp in either order.
+     **/
+    void functions()
+    {
+        for (unsigned index = 0; index < tok::BUILTIN_COUNT; index++)
+        {
+            const tok::FunctionEntry &function = tok::BUILTINS[index];
+            // Every combination of the edge values, one row each.
+            size_t rows = 1;
+            for (unsigned i = 0; i < function.arity; i++)
+                rows *= REALS.size();
+            vector<double> arguments(function.arity * rows);
+            for (size_t r = 0; r < rows; r++)
+                for (size_t i = 0, k = r; i < function.arity; i++, k /= REALS.size())
+                    arguments[i * rows + r] = REALS[k % REALS.size()];
+            vector<double> expected(rows);
+            for (size_t r = 0; r < rows; r++)
+            {
+                double row[tok::MAX_ARITY];
+                for (unsigned i = 0; i < function.arity; i++)
+                    row[i] = arguments[i * rows + r];
+                expected[r] = function.scalar(row);
+            }
+            function.batch(arguments.data(), rows, rows);
+            for (size_t r = 0; r < rows; r++)
+                check(sameBits(expected[r], arguments[r]) || (isnan(expected[r]) && isnan(arguments[r])),
+                      string(function.name) + " row " + to_string(r) + ": " + show(arguments[r]) + " instead of " + show(expected[r]));
+        }
+        const double zeros[][2] = {{0.0, -0.0}, {-0.0, 0.0}};
+        for (const double *pair : zeros)
+        {
+            check(sameBits(tok::BUILTINS[tok::findBuiltin("min")].scalar(pair), -0.0), "min of 0 and -0");
+            check(sameBits(tok::BUILTINS[tok::findBuiltin("max")].scalar(pair), 0.0), "max of 0 and -0");
+            double range[] = {pair[0], pair[1], 1.0};
+            check(sameBits(tok::clamp(range), 0.0), "clamp of a signed zero");
+        }
+        const double nan[] = {NaN, 1.0};
+        check(tok::minimum(nan[0], nan[1]) == 1.0 && tok::maximum(nan[1], nan[0]) == 1.0, "a NaN loses to a number");
+    }
+    // A file of its own with the given contents, removed again at the end.
+    struct TemporaryFile
+    {
+        string path;
+
+        explicit TemporaryFile(const string &contents)
+        {
+            char name[] = "/tmp/tok-test-XXXXXX";
+            int fd = mkstemp(name);
+            check(fd >= 0, "create a temporary file");
+            path = name;
+            check(write(fd, contents.data(), contents.size()) == (ssize_t)contents.size(), "write the file");
+            close(fd);
+        }
+        ~TemporaryFile()
+        {
+            unlink(path.c_str());
+        }
+    };
+    /**
+     * A pipe has no size to map, MappedFile reads it instead. stream() takes
+     * its expressions from a file and the bindings from a pipe.
+     **/
+    void files()
+    {
+        int fds[2];
+        check(pipe(fds) == 0, "pipe");
+        const string text = "a+1\nb*2\n";
+        check(write(fds[1], text.data(), text.size()) == (ssize_t)text.size(), "write to the pipe");
+        close(fds[1]);
+        {
+            tok::MappedFile file("/dev/fd/" + to_string(fds[0]));
+            check(string(file.data, file.size) == text, "a pipe is read to its end");
+        }
+        close(fds[0]);
+        TemporaryFile input("a+1\nb*2\n1+\nc\n"), output("");
+        check(pipe(fds) == 0, "pipe");
+        const string bindings = "a,b\n1,2.5\n";
+        check(write(fds[1], bindings.data(), bindings.size()) == (ssize_t)bindings.size(), "write to the pipe");
+        close(fds[1]);
+        tok::StreamOptions options;
+        options.input = input.path;
+        options.bindings = "/dev/fd/" + to_string(fds[0]);
+        int out = open(output.path.c_str(), O_WRONLY | O_TRUNC);
+        size_t failed = tok::stream(options, out);
+        close(out);
+        close(fds[0]);
+        tok::MappedFile result(output.path);
+        check(failed == 2, "two expressions fail");
+        check(string(result.data, result.size) == "2\n5\nerror: Missing operand at 2\nerror: No value for variable c\n",
+              "the stream writes one line per expression: " + string(result.data, result.size));
+    }
+    // The message compiling the expression through the cache throws, or
+    // nothing if it compiles.
+    string error(const string &expr)
+    {
+        try
+        {
+            tok::cache().get(expr);
+        }
+        catch (const invalid_argument &e)
+        {
+            return e.what();
+        }
+        return "";
+    }
+    /**
+     * Expressions that only differ in spacing share one program, and the
+     * least recently used one goes when the cache is full. The key drops
+     * only the spaces that do not separate two tokens, and errors cite the
+     * positions of the text as it was written.
+     **/
+    void cache()
+    {
+        tok::ExpressionCache cache(2, 1);
+        shared_ptr<const tok::CompiledExpression> program = cache.get("a + b");
+        check(cache.get("a+b") == program && cache.get(" a +  b ") == program, "spacing shares one program");
+        check(cache.hits() == 2 && cache.misses() == 1, "two hits and a miss");
+        cache.get("a*b");
+        cache.get("a+b");
+        cache.get("a-b");
+        check(cache.size() == 2 && cache.evictions() == 1 && cache.get("a+b") == program, "the least recently used program is evicted");
+        const pair<string, string> keys[] = {{" a +  b ", "a+b"},   {"sin( x )", "sin(x)"},   {"a b", "a b"},
+                                             {"1 & & 1", "1& &1"},  {"1 | | 0", "1| |0"},     {"a && b", "a&&b"},
+                                             {"1e -5", "1e -5"},    {"2 - 1", "2-1"},         {"x1 .5", "x1 .5"},
+                                             {"1e- 5", "1e- 5"},    {"1E+ 5", "1E+ 5"},       {"e- 5", "e-5"}};
+        for (const auto &key : keys)
+        {
+            string buffer;
+            check(string(tok::ExpressionCache::normalize(key.first, buffer)) == key.second, "the key of \"" + key.first + "\"");
+        }
+        for (const string expr : {"1 & & 1", "1 | | 0", "1 &  & 1"})
+            check(!error(expr).empty(), "\"" + expr + "\" does not compile");
+        check(error("1 +  2 ) ") == error("1 +  2 ) "), "the error is the same the second time");
+        check(error("1 +  2 ) ").find(" 7") != string::npos, "the error of \"1 +  2 ) \" is at 7: " + error("1 +  2 ) "));
+        check(error("1+2)").find(" 3") != string::npos, "the error of \"1+2)\" is at 3: " + error("1+2)"));
+        check(tok::cache().get("1e-5")->run() == 1e-5 && tok::cache().get("2*e - 1")->run(vector<double>{3.0}) == 5.0,
+              "spacing keeps the meaning");
+        check(!error("1e- 5").empty(), "\"1e- 5\" does not compile even with 1e-5 in the cache");
+    }
+    // NaN compares unequal to itself, any two of them count as the same.
+    bool same(double a, double b)
+    {
+        return sameBits(a, b) || (isnan(a) && isnan(b));
+    }
+    /**
+     * Sets of random rules sharing sub-expressions, compiled into one program
+     * and run row by row, for a whole table and on a pool, against each rule
+     * compiled on its own. Every other set is run by the JIT.
+     **/
+    void rules()
+    {
+        mt19937 random(7);
+        const char *operators[] = {"+", "-", "*", "/", "%", "&", "|", "&&", "||"};
+        auto leaf = [&]() { return random() % 3 ? "v" + to_string(random() % 8) : to_string(random() % 9); };
+        const string common = "(v1-v2)/v1";
+        tok::ThreadPool pool(3);
+        for (int set = 0; set < 40; set++)
+        {
+            vector<string> exprs;
+            for (size_t k = 0, count = 1 + random() % 30; k < count; k++)
+            {
+                string expr = random() % 2 ? common : leaf();
+                for (int depth = random() % 5; depth >= 0; depth--)
+                {
+                    size_t choice = random() % 12;
+                    if (choice == 9)
+                        expr = "max(" + expr + "," + leaf() + ")";
+                    else if (choice == 10)
+                        expr = "(" + expr + ")?" + leaf() + ":" + common;
+                    else if (choice == 11)
+                        expr = "(" + expr + ")*" + common;
+                    else
+                        expr = "(" + expr + ")" + operators[choice] + leaf();
+                }
+                exprs.push_back(expr);
+            }
+            vector<string_view> views(exprs.begin(), exprs.end());
+            tok::CompileOptions options;
+            options.jitThreshold = set % 2;
+            tok::CompiledExpression program = tok::compile(views, options);
+            check(program.getOutputs() == exprs.size(), "one output per rule");
+            size_t rows = 1000 + set, slots = program.getSymbols().size();
+            vector<vector<double>> columns(slots, vector<double>(rows));
+            vector<const double *> columnPointers;
+            for (vector<double> &column : columns)
+            {
+                for (double &value : column)
+                    value = (double)((int)(random() % 21) - 10) / (random() % 2 ? 1 : 4);
+                columnPointers.push_back(column.data());
+            }
+            vector<vector<double>> batch(exprs.size(), vector<double>(rows)), parallel = batch;
+            vector<double *> batchPointers, parallelPointers;
+            for (size_t k = 0; k < exprs.size(); k++)
+            {
+                batchPointers.push_back(batch[k].data());
+                parallelPointers.push_back(parallel[k].data());
+            }
+            vector<double> last(rows), lastParallel(rows);
+            program.run(columnPointers.data(), rows, last.data(), batchPointers.data());
+            program.run(columnPointers.data(), rows, lastParallel.data(), parallelPointers.data(), pool);
+            vector<double> outputs(program.getOutputs()), bindings(slots);
+            for (size_t k = 0; k < exprs.size(); k++)
+            {
+                tok::CompiledExpression single = tok::compile(exprs[k]);
+                vector<double> singleBindings(single.getSymbols().size());
+                for (size_t r = 0; r < rows; r += 37)
+                {
+                    for (size_t slot = 0; slot < slots; slot++)
+                        bindings[slot] = columns[slot][r];
+                    for (size_t slot = 0; slot < singleBindings.size(); slot++)
+                        singleBindings[slot] = bindings[program.getSymbols().find(single.getSymbols().getName(slot))];
+                    double expected = single.run(singleBindings);
+                    double result = program.run(bindings.data(), outputs.data());
+                    bool ok = same(expected, outputs[k]) && same(expected, batch[k][r]) && same(expected, parallel[k][r]);
+                    if (k + 1 == exprs.size())
+                        ok = ok && same(expected, result) && same(expected, last[r]) && same(expected, lastParallel[r]);
+                    check(ok, "rule " + exprs[k] + " of set " + to_string(set) + " at row " + to_string(r) + ": " + show(outputs[k]) +
+                                  " instead of " + show(expected));
+                }
+            }
+        }
+        // Without room for the outputs a program that yields values throws.
+        tok::CompiledExpression program = tok::compile(vector<string_view>{"a+1", "a*2"});
+        double a = 3.0, out;
+        const double *columns[] = {&a};
+        auto throws = [](auto run) {
+            try
+            {
+                run();
+            }
+            catch (const invalid_argument &)
+            {
+                return true;
+            }
+            return false;
+        };
+        check(throws([&]() { program.run(&a); }), "run(bindings) without outputs throws");
+        check(throws([&]() { program.run(columns, 1, &out); }), "run(columns) without outputs throws");
+        check(throws([&]() { program.run(columns, 1, &out, pool); }), "run(columns, pool) without outputs throws");
+        double outputs[2];
+        check(program.run(&a, outputs) == 6.0 && outputs[0] == 4.0 && outputs[1] == 6.0, "run(bindings, outputs)");
+    }
+    /**
+     * %, & and | on integers, the results that need all 64 bits included,
+     * interpreted with and without the optimizer and superinstructions, for
+     * a table and by the JIT.
+     **/
+    void integers()
+    {
+        struct Case
+        {
+            const char *expr;
+            double expected;
+        };
+        // a = 0.5, b = NaN, c = 2^52 and d = -7.9.
+        const Case cases[] = {{"((0.5%0)|1)%3", -1.0},
+                              {"((0.5%0)|1)&7", 1.0},
+                              {"((0.5%0)|5)%1000", -803.0},
+                              {"((a%0)|1)%3", -1.0},
+                              {"((a%0)|5)%1000", -803.0},
+                              {"(a%0)%-1", 0.0},
+                              {"b%3", -2.0},
+                              {"(b|1)%3", -1.0},
+                              {"(c|1)%3", 2.0},
+                              {"c|1", 4503599627370497.0},
+                              {"-7%3", -1.0},
+                              {"7%-3", 1.0},
+                              {"d%3", -1.0},
+                              {"d&255", 249.0},
+                              {"7.9&3", 3.0},
+                              {"-1&255", 255.0},
+                              {"(a|2)*0.5", 1.0},
+                              {"5%0", NaN},
+                              {"a%(a-a)", NaN},
+                              // The literal is a double already, 2^53 + 1 rounds to 2^53.
+                              {"9007199254740993&1", 0.0}};
+        const double bindings[] = {0.5, NaN, 0x1p52, -7.9};
+        for (const Case &test : cases)
+        {
+            for (int variant = 0; variant < 4; variant++)
+            {
+                tok::CompileOptions options;
+                options.optimize = variant != 1;
+                options.superinstructions = variant != 2;
+                options.jitThreshold = variant == 3 ? 1 : 0;
+                tok::CompiledExpression program = tok::compile(test.expr, options);
+                vector<double> values(program.getSymbols().size());
+                vector<vector<double>> columns;
+                vector<const double *> pointers;
+                for (size_t slot = 0; slot < values.size(); slot++)
+                {
+                    values[slot] = bindings[program.getSymbols().getName(slot)[0] - 'a'];
+                    columns.emplace_back(3, values[slot]);
+                }
+                for (const vector<double> &column : columns)
+                    pointers.push_back(column.data());
+                string name = string(test.expr) + " in variant " + to_string(variant);
+                // The JIT takes over after the first row.
+                for (int run = 0; run < 2; run++)
+                {
+                    double result = program.run(values);
+                    check(same(result, test.expected), name + ": " + show(result) + " instead of " + show(test.expected));
+                }
+                vector<double> out(3);
+                program.run(pointers.data(), out.size(), out.data());
+                for (double result : out)
+                    check(same(result, test.expected), name + " for a table: " + show(result) + " instead of " + show(test.expected));
+            }
+        }
+    }
+    /**
+     * A random expression over the variables a to d, the literals that are
+     * hard on an optimizer, every operator and the built-in functions.
+     **/
+    string expression(mt19937 &random, int depth)
+    {
+        static const char *const LEAVES[] = {"a", "b", "c", "d", "0", "1", "2", "0.5", "-0", "(0/0)", "(1/0)", "(-1/0)", "3"};
+        static const char *const BINARY[] = {"+", "-", "*", "/", "%", "&", "|", "&&", "||"};
+        static const char *const CALLS[] = {"min", "max", "pow", "abs", "floor", "sqrt", "clamp"};
+        if (depth == 0 || random() % 5 == 0)
+            return LEAVES[random() % size(LEAVES)];
+        switch (random() % 8)
+        {
+        case 0:
+            return string(random() % 2 ? "-" : "!") + "(" + expression(random, depth - 1) + ")";
+        case 1:
+            return "(" + expression(random, depth - 1) + ")?(" + expression(random, depth - 1) + "):(" + expression(random, depth - 1) + ")";
+        case 2:
+        {
+            string name = CALLS[random() % size(CALLS)];
+            unsigned arity = tok::BUILTINS[tok::findBuiltin(name)].arity;
+            string call = name + "(" + expression(random, depth - 1);
+            for (unsigned i = 1; i < arity; i++)
+                call += "," + expression(random, depth - 1);
+            return call + ")";
+        }
+        case 3:
+        {
+            // The same operand twice, for the common sub-expressions.
+            string shared = expression(random, depth - 1);
+            return "(" + shared + ")" + BINARY[random() % size(BINARY)] + "(" + shared + ")";
+        }
+        default:
+            return "(" + expression(random, depth - 1) + ")" + BINARY[random() % size(BINARY)] + "(" + expression(random, depth - 1) + ")";
+        }
+    }
+    // The expressions every differential check runs on: the edge cases
+    // written out and a reproducible set of random ones.
+    vector<string> corpus()
+    {
+        vector<string> exprs = {"a+0", "a+-0", "0+a", "-0+a", "a-0", "a*1", "a*0", "a/1", "-(-a)", "!!a", "!!(a&&b)", "a&0", "0&&a",
+                                "1||a", "a&&b", "a||b", "a?b:c", "a?b:b", "1?a:b", "0?a:b", "(0/0)?a:b", "a%b", "a%0", "a&b|c",
+                                "(a+b)*(a+b)", "min(a,b)", "max(a,-a)", "min(0,-0)", "max(-0,0)", "clamp(a,b,c)", "clamp(-0,0,1)",
+                                "a*b+a*b-c", "(a&&b)?(c||d):(a%3)", "-(0)", "-0*a", "a*-0", "0*(1/0)", "(0/0)*0", "!(0/0)",
+                                "(0/0)&&0", "(0/0)||0", "((0.5%0)|1)%3", "a?(1/0):(-1/0)", "pow(a,0)", "abs(-0)", "floor(-0.5)"};
+        mt19937 random(2024);
+        for (int i = 0; i < 400; i++)
+            exprs.push_back(expression(random, 1 + i % 5));
+        return exprs;
+    }
+    // The bindings of a, b, c and d every expression is run with: all the
+    // edge values, and random small numbers.
+    vector<vector<double>> rows()
+    {
+        vector<vector<double>> rows;
+        const double values[] = {0.0, -0.0, 1.0, -1.0, 0.5, -2.5, 3.0, NaN, INF, -INF, 1e300, 0x1p53 + 2, -0x1p63};
+        for (size_t i = 0; i < size(values); i++)
+            for (size_t j = 0; j < size(values); j++)
+                rows.push_back({values[i], values[j], values[(i + j) % size(values)], values[(i * 7 + j) % size(values)]});
+        mt19937 random(99);
+        for (int i = 0; i < 200; i++)
+        {
+            vector<double> row(4);
+            for (double &value : row)
+                value = (double)((int)(random() % 41) - 20) / (1 << random() % 3);
+            rows.push_back(row);
+        }
+        return rows;
+    }
+    // Evaluate the expression row by row and for the whole table at once.
+    struct Results
+    {
+        vector<double> scalar;
+        vector<double> batch;
+    };
+    Results evaluate(const tok::CompiledExpression &program, const vector<vector<double>> &table)
+    {
+        Results results{vector<double>(table.size()), vector<double>(table.size())};
+        vector<vector<double>> columns(program.getSymbols().size(), vector<double>(table.size()));
+        vector<const double *> pointers;
+        vector<double> bindings(program.getSymbols().size());
+        for (size_t r = 0; r < table.size(); r++)
+        {
+            for (size_t slot = 0; slot < bindings.size(); slot++)
+                bindings[slot] = columns[slot][r] = table[r][program.getSymbols().getName(slot)[0] - 'a'];
+            results.scalar[r] = program.run(bindings);
+        }
+        for (const vector<double> &column : columns)
+            pointers.push_back(column.data());
+        program.run(pointers.data(), table.size(), results.batch.data());
+        return results;
+    }
+    void compare(const string &what, const string &expr, const vector<vector<double>> &table, const Results &expected, const Results &actual)
+    {
+        for (size_t r = 0; r < table.size(); r++)
+        {
+            string row = " of " + expr + " at a=" + to_string(table[r][0]) + " b=" + to_string(table[r][1]) + " c=" + to_string(table[r][2]) +
+                         " d=" + to_string(table[r][3]) + ": ";
+            check(same(expected.scalar[r], actual.scalar[r]), what + row + show(actual.scalar[r]) + " instead of " + show(expected.scalar[r]));
+            check(same(expected.batch[r], actual.batch[r]), what + " for a table" + row + show(actual.batch[r]) + " instead of " + show(expected.batch[r]));
+            check(same(expected.scalar[r], expected.batch[r]), "batch" + row + show(expected.batch[r]) + " instead of " + show(expected.scalar[r]));
+        }
+    }
+    /**
+     * The optimized program against the one compiled as written, on every
+     * expression of the corpus. Without finiteMath every rewrite has to keep
+     * the result to the bit, signed zeros included.
+     **/
+    void optimizer()
+    {
+        vector<vector<double>> table = rows();
+        tok::CompileOptions plain;
+        plain.optimize = false;
+        plain.jitThreshold = 0;
+        tok::CompileOptions optimized = plain;
+        optimized.optimize = true;
+        tok::CompileOptions unshared = optimized;
+        unshared.cse = false;
+        for (const string &expr : corpus())
+        {
+            Results expected = evaluate(tok::compile(expr, plain), table);
+            compare("optimized", expr, table, expected, evaluate(tok::compile(expr, optimized), table));
+            compare("optimized without cse", expr, table, expected, evaluate(tok::compile(expr, unshared), table));
+        }
+    }
+    /**
+     * The native code of the scalar and the block JIT against the threaded
+     * interpreter, on the same corpus, optimized and as written so that the
+     * constant operands of &&, || and ?: reach the JIT as well. The table
+     * has an odd number of rows, which leaves one to the scalar code.
+     **/
+    void jit()
+    {
+        if (!tok::jitSupported())
+            return;
+        vector<vector<double>> table = rows();
+        check(table.size() % 2 == 1, "the table leaves a row over");
+        size_t jitted = 0, blocks = 0;
+        for (bool optimize : {false, true})
+        {
+            tok::CompileOptions interpreted;
+            interpreted.optimize = optimize;
+            interpreted.jitThreshold = 0;
+            tok::CompileOptions native = interpreted;
+            native.jitThreshold = 1;
+            for (const string &expr : corpus())
+            {
+                Results expected = evaluate(tok::compile(expr, interpreted), table);
+                tok::CompiledExpression program = tok::compile(expr, native);
+                // The first run compiles, the rest run the native code.
+                program.run(vector<double>(program.getSymbols().size()));
+                if (!program.isJitted())
+                    continue;
+                jitted++;
+                blocks += tok::jit(program)->block != nullptr;
+                compare(string("jitted, optimize=") + (optimize ? "on" : "off"), expr, table, expected, evaluate(program, table));
+            }
+        }
+        // Most of the corpus has to make it into native code, and into the
+        // block loop, or this tests little.
+        check(jitted > corpus().size(), "the corpus is jitted: " + to_string(jitted));
+        check(blocks > corpus().size() / 2, "the corpus has block code: " + to_string(blocks));
+    }
+    // The message loading the program from the image throws, or nothing if
+    // it loads.
+    string load(const string &image, size_t index = 0)
+    {
+        TemporaryFile file(image);
+        try
+        {
+            tok::ProgramFile(file.path).load(index);
+        }
+        catch (const exception &e)
+        {
+            return e.what();
+        }
+        return "";
+    }
+    // Recompute the checksum after the image was changed behind the header,
+    // FNV-1a like Binary.cpp.
+    string seal(string image)
+    {
+        uint64_t hash = 0xCBF29CE484222325ull;
+        for (size_t i = 32; i < image.size(); i++)
+            hash = (hash ^ (unsigned char)image[i]) * 0x100000001B3ull;
+        memcpy(&image[24], &hash, sizeof(hash));
+        return image;
+    }
+    template <typename T>
+    string patch(string image, size_t offset, T value)
+    {
+        memcpy(&image[offset], &value, sizeof(value));
+        return image;
+    }
+    /**
+     * Programs survive the round trip through a program file, and every way
+     * a file can be broken is rejected before anything is sized from it.
+     **/
+    void programFiles()
+    {
+        const vector<string_view> sources = {"a+b*2", "max(a,1)?a:-b", "((0.5%0)|1)%3"};
+        vector<tok::CompiledExpression> programs;
+        vector<const tok::CompiledExpression *> pointers;
+        for (string_view source : sources)
+            programs.push_back(tok::compile(source));
+        for (const tok::CompiledExpression &program : programs)
+            pointers.push_back(&program);
+        const string image = tok::serialize(sources, pointers);
+        {
+            TemporaryFile file(image);
+            tok::ProgramFile loaded(file.path);
+            check(loaded.size() == sources.size(), "every program is in the file");
+            for (size_t k = 0; k < sources.size(); k++)
+            {
+                tok::CompiledExpression program = loaded.load(k);
+                check(loaded.source(k) == sources[k], "the source of program " + to_string(k));
+                check(program.getProgram().size() == programs[k].getProgram().size(), "the instructions of program " + to_string(k));
+                vector<double> bindings = {2.0, -3.0};
+                bindings.resize(program.getSymbols().size());
+                check(same(program.run(bindings), programs[k].run(bindings)), "the result of program " + to_string(k));
+            }
+        }
+        // The first record starts behind the header and the offsets, its
+        // instructions behind the record header.
+        uint64_t record;
+        memcpy(&record, &image[32], sizeof(record));
+        const size_t instructions = record + 24;
+        auto instruction = [&](size_t i, tok::OPCODE op, uint32_t arg) {
+            return seal(patch(patch(image, instructions + 8 * i, op), instructions + 8 * i + 4, arg));
+        };
+        const pair<string, string> broken[] = {
+            {"a file shorter than the header", image.substr(0, 20)},
+            {"a truncated file", image.substr(0, image.size() - 8)},
+            {"another magic", patch(image, 0, 'X')},
+            {"another version", patch(image, 8, (uint32_t)tok::BINARY_VERSION + 1)},
+            {"another checksum", patch(image, image.size() - 1, (char)(image.back() ^ 1))},
+            {"more records than fit", seal(patch(image, 12, (uint32_t)0xFFFFFFFF))},
+            {"a record behind the end", seal(patch(image, 32, (uint64_t)image.size() + 8))},
+            {"an unaligned record", seal(patch(image, 32, record + 4))},
+            {"more instructions than fit", seal(patch(image, record, (uint32_t)0xFFFFFFFF))},
+            {"more constants than fit", seal(patch(image, record + 4, (uint32_t)0x10000000))},
+            {"more names than fit", seal(patch(image, record + 8, (uint32_t)0x7FFFFFFF))},
+            {"an unknown opcode", instruction(0, (tok::OPCODE)tok::OPCODES, 0)},
+            {"a constant that is not there", instruction(1, tok::OPCODE::CONST, 99)},
+            {"a variable that is not there", instruction(0, tok::OPCODE::LOAD, 2)},
+            {"a temporary beyond the instructions", instruction(0, tok::OPCODE::RECALL, 0xFFFFFFFF)},
+            {"an output beyond the instructions", instruction(2, tok::OPCODE::YIELD, 0xFFFFFFFF)},
+            {"a call of a function that is not there", instruction(1, tok::OPCODE::CALL, 5)},
+            {"an operation without operands", instruction(0, tok::OPCODE::ADD, 0)}};
+        for (const auto &file : broken)
+            check(!load(file.second).empty(), file.first + " is rejected");
+        check(load(image, sources.size()).find("No program") == 0, "a program that is not there is rejected");
+        // A name the process does not know. The names follow the source, so
+        // the last max is the name of the function.
+        string renamed = image;
+        size_t max = renamed.rfind("max");
+        check(max != string::npos, "the image holds the name max");
+        renamed[max + 1] = 'q';
+        check(load(seal(renamed), 1).find("Unknown function mqx") == 0, "an unknown function is rejected");
+    }
+    /**
+     * The threaded code with superinstructions against the one without, on
+     * the corpus and as written, so that every fused sequence is met.
+     **/
+    void superinstructions()
+    {
+        vector<vector<double>> table = rows();
+        tok::CompileOptions plain;
+        plain.optimize = false;
+        plain.superinstructions = false;
+        plain.jitThreshold = 0;
+        tok::CompileOptions fused = plain;
+        fused.superinstructions = true;
+        for (const string &expr : corpus())
+            compare("fused", expr, table, evaluate(tok::compile(expr, plain), table), evaluate(tok::compile(expr, fused), table));
+    }
+    /**
+     * Every index of a parallelFor runs exactly once, and a table split over
+     * the pool comes out the same as in one piece, whatever the number of
+     * threads and however the last chunk ends.
+     **/
+    void threadPool()
+    {
+        {
+            // Many small runs back to back on more threads than there are
+            // cores, so that workers are still stealing from one run when the
+            // next one starts.
+            tok::ThreadPool pool(4 * max(thread::hardware_concurrency(), 2u));
+            atomic<size_t> total{0};
+            size_t expected = 0;
+            for (size_t run = 0; run < 3000; run++)
+            {
+                size_t count = 1 + run % pool.size();
+                pool.parallelFor(count, [&](size_t index) { total += index + 1; });
+                expected += count * (count + 1) / 2;
+            }
+            check(total == expected, "back to back runs run every task once");
+        }
+        for (size_t threads : {1, 3, 8})
+        {
+            tok::ThreadPool pool(threads);
+            vector<atomic<int>> runs(1000);
+            pool.parallelFor(runs.size(), [&](size_t index) { runs[index]++; });
+            bool once = true;
+            for (const atomic<int> &count : runs)
+                once = once && count == 1;
+            check(once, "every index runs once on " + to_string(threads) + " threads");
+            vector<string> exprs = corpus();
+            exprs.resize(60);
+            const size_t rows = 3 * tok::CHUNK_SIZE + 77;
+            vector<vector<double>> columns(4, vector<double>(rows));
+            mt19937 random(threads);
+            for (vector<double> &column : columns)
+                for (double &value : column)
+                    value = random() % 17 == 0 ? REALS[random() % REALS.size()] : (double)((int)(random() % 41) - 20) / 4;
+            for (const string &expr : exprs)
+            {
+                tok::CompileOptions options;
+                options.jitThreshold = 0;
+                tok::CompiledExpression program = tok::compile(expr, options);
+                vector<const double *> pointers;
+                for (size_t slot = 0; slot < program.getSymbols().size(); slot++)
+                    pointers.push_back(columns[program.getSymbols().getName(slot)[0] - 'a'].data());
+                vector<double> expected(rows), actual(rows);
+                program.run(pointers.data(), rows, expected.data());
+                program.run(pointers.data(), rows, actual.data(), pool);
+                size_t differ = 0;
+                for (size_t r = 0; r < rows; r++)
+                    differ += !same(expected[r], actual[r]);
+                check(differ == 0, expr + " on " + to_string(threads) + " threads differs in " + to_string(differ) + " rows");
+            }
+        }
+    }
+    // The calls of the impure function count() so far.
+    size_t counted = 0;
+    /**
+     * The right operand of && and || and the arm of ?: that is not taken are
+     * not evaluated at all: count() is only called for the rows that need
+     * it, row by row, for a table and in native code.
+     **/
+    void shortCircuit()
+    {
+        tok::registerFunction("count", 1, [](const double *arguments) { return counted++, arguments[0]; }, nullptr, false);
+        struct Case
+        {
+            const char *expr;
+            // The rows of a = 0, 1, 0, 1, ... that call count().
+            size_t odd, even;
+        };
+        const Case cases[] = {{"a && count(b)", 1, 0}, {"a || count(b)", 0, 1}, {"a ? count(b) : b", 1, 0},
+                              {"a ? b : count(b)", 0, 1}, {"(a && count(b)) || count(a)", 1, 1}, {"count(a) && b", 1, 1},
+                              // The optimizer must not drop an operand that is always evaluated.
+                              {"count(a) && 0", 1, 1}, {"count(a) || 1", 1, 1}, {"count(a) & 0", 1, 1}, {"0 | 0 & count(a)", 1, 1},
+                              {"count(a) ? b : b", 1, 1}, {"0 && count(a)", 0, 0}, {"1 || count(a)", 0, 0}, {"0 ? count(a) : b", 0, 0}};
+        const size_t rows = 2 * tok::BLOCK_SIZE + 3;
+        vector<double> a(rows), b(rows, 2.0);
+        for (size_t r = 0; r < rows; r++)
+            a[r] = r % 2;
+        const size_t odd = rows / 2, even = rows - odd;
+        for (const Case &test : cases)
+        {
+            const size_t expected = test.odd * odd + test.even * even;
+            for (uint64_t threshold : {0, 1})
+            {
+                tok::CompileOptions options;
+                options.jitThreshold = threshold;
+                tok::CompiledExpression program = tok::compile(test.expr, options);
+                string name = string(test.expr) + (threshold ? " jitted" : "");
+                double bindings[2];
+                // With a threshold of 1 the first row compiles, the rest run native code.
+                counted = 0;
+                for (size_t r = 0; r < rows; r++)
+                {
+                    bindings[program.getSymbols().find("a")] = a[r];
+                    if (program.getSymbols().find("b") >= 0)
+                        bindings[program.getSymbols().find("b")] = b[r];
+                    program.run(bindings);
+                }
+                check(counted == expected, name + " calls count " + to_string(counted) + " times row by row instead of " + to_string(expected));
+                const double *columns[2];
+                columns[program.getSymbols().find("a")] = a.data();
+                if (program.getSymbols().find("b") >= 0)
+                    columns[program.getSymbols().find("b")] = b.data();
+                vector<double> out(rows);
+                counted = 0;
+                program.run(columns, rows, out.data());
+                check(counted == expected, name + " calls count " + to_string(counted) + " times for a table instead of " + to_string(expected));
+            }
+        }
+        // Not even finiteMath drops a call from x*0.
+        tok::CompileOptions finite;
+        finite.finiteMath = true;
+        counted = 0;
+        tok::compile("count(a)*0", finite).run(vector<double>{1.0});
+        check(counted == 1, "count(a)*0 calls count");
+    }
+    /**
+     * The parser gets precedence, associativity, the literal forms and the
+     * errors right, citing the position of the offending token.
+     **/
+    void parser()
+    {
+        const pair<const char *, double> values[] = {
+            {"1+2*3", 7.0},       {"2-3-4", -5.0},       {"2/4/2", 0.25},       {"-2*-3", 6.0},       {"--2", 2.0},
+            {"!0+1", 2.0},        {"1?2:0?3:4", 2.0},    {"0?2:0?3:4", 4.0},    {"1||0&&0", 1.0},     {"6&3|8", 10.0},
+            {"7%4*2", 6.0},       {"(1+2)*3", 9.0},      {"[1+2]*{3}", 9.0},    {"max(1,2,3)", 3.0},  {"min(4,max(2,3))", 3.0},
+            {"1e3", 1000.0},      {"2.5e-1", 0.25},      {"0x1F", 31.0},        {"017", 15.0},        {" 1 + 2 ", 3.0}};
+        for (const auto &value : values)
+        {
+            double result = tok::compile(value.first).run();
+            check(result == value.second, string(value.first) + " is " + show(result) + " instead of " + show(value.second));
+        }
+        const pair<const char *, const char *> errors[] = {{"1+", "Missing operand at 2"},
+                                                          {"(1+2", "Unbalanced parenthesis at 0"},
+                                                          {"1+2)", "Unbalanced parenthesis at 3"},
+                                                          {"1 2", "Missing operator at 2"},
+                                                          {"foo(1)", "Unknown function foo at 0"},
+                                                          {"max(1)", "max takes 2 or more arguments, not 1 at 0"},
+                                                          {"1?2", "? without a : at 1"},
+                                                          {"1,2", "Comma outside of a function call at 1"},
+                                                          {"", "Empty expression"}};
+        for (const auto &error : errors)
+        {
+            string message;
+            try
+            {
+                tok::compile(error.first);
+            }
+            catch (const invalid_argument &e)
+            {
+                message = e.what();
+            }
+            check(message == error.second, "\"" + string(error.first) + "\" fails with \"" + message + "\" instead of \"" + error.second + "\"");
+        }
+    }
+    /**
+     * A workbook recomputes only the nodes an input reaches, stops where a
+     * value stays the same, and always agrees with compiling every formula
+     * on its own.
+     **/
+    void workbook()
+    {
+        {
+            tok::Workbook book;
+            book.add("a+b");
+            book.add("(a+b)*2");
+            book.add("c+1");
+            book.set({{"a", 1.0}, {"b", 2.0}, {"c", 3.0}});
+            check(book.get(0) == 3.0 && book.get(1) == 6.0 && book.get(2) == 4.0, "the formulas are computed");
+            check(book.getShared() >= 2, "a+b is one node");
+            // LOAD c and c+1.
+            check(book.set("c", 5.0) == 2 && book.get(2) == 6.0, "only what c reaches is recomputed");
+            // LOAD b, which stays the same.
+            check(book.set("b", 2.0) == 1, "an unchanged input stops at its LOAD");
+            check(book.set("b", -2.0) == 3 && book.get(1) == -2.0, "b reaches a+b and (a+b)*2");
+            // Computed eagerly, a ?: would call both arms.
+            tok::registerFunction("sample", 1, [](const double *arguments) { return arguments[0]; }, nullptr, false);
+            bool refused = false;
+            try
+            {
+                book.add("a ? sample(b) : 0");
+            }
+            catch (const invalid_argument &)
+            {
+                refused = true;
+            }
+            check(refused && book.size() == 3, "a formula calling an impure function is refused");
+        }
+        vector<string> exprs = corpus();
+        tok::Workbook book;
+        for (const string &expr : exprs)
+            book.add(expr);
+        vector<tok::CompiledExpression> programs;
+        for (const string &expr : exprs)
+            programs.push_back(tok::compile(expr));
+        vector<vector<double>> table = rows();
+        double values[4] = {NaN, NaN, NaN, NaN};
+        for (size_t r = 0; r < table.size(); r++)
+        {
+            // Change one or two of the inputs at a time.
+            size_t variable = r % 4;
+            values[variable] = table[r][variable];
+            book.set(string(1, 'a' + variable), values[variable]);
+            if (r % 3 == 0)
+            {
+                values[(variable + 1) % 4] = table[r][(variable + 1) % 4];
+                book.set({{string(1, 'a' + (variable + 1) % 4), values[(variable + 1) % 4]}});
+            }
+            for (size_t k = 0; k < exprs.size(); k++)
+            {
+                vector<double> bindings(programs[k].getSymbols().size());
+                for (size_t slot = 0; slot < bindings.size(); slot++)
+                    bindings[slot] = values[programs[k].getSymbols().getName(slot)[0] - 'a'];
+                double expected = programs[k].run(bindings);
+                check(same(book.get(k), expected), "the workbook's " + exprs[k] + " after row " + to_string(r) + ": " + show(book.get(k)) +
+                                                       " instead of " + show(expected));
+            }
+        }
+    }
+    /**
+     * With instrumenting on, every stage a program goes through is timed
+     * once and every instruction it runs is counted. With it off nothing is.
+     * Only the build with TOK_TRACE has the counters at all.
+     **/
+    void tracing()
+    {
+#if TOK_TRACE
+        tok::Statistics &statistics = tok::trace().statistics;
+        auto calls = [&](tok::STAGE stage) { return statistics.calls[(size_t)stage].load(); };
+        tok::CompileOptions options;
+        options.jitThreshold = 0;
+        statistics.reset();
+        tok::trace().setInstrumenting(true);
+        tok::CompiledExpression program = tok::compile("a*2+1", options);
+        program.run(vector<double>{3.0});
+        tok::Arena arena;
+        tok::SymbolTable symbols;
+        tok::evaluate(tok::infixtopostfix(tok::tokenization("1+2", symbols, arena)));
+        tok::trace().setInstrumenting(false);
+        const tok::STAGE stages[] = {tok::STAGE::TOKENIZE, tok::STAGE::PARSE, tok::STAGE::ASSEMBLE, tok::STAGE::OPTIMIZE, tok::STAGE::EVALUATE};
+        const uint64_t expected[] = {1, 1, 1, 1, 2};
+        for (size_t i = 0; i < size(stages); i++)
+            check(calls(stages[i]) == expected[i], "stage " + to_string(i) + " ran " + to_string(calls(stages[i])) + " times");
+        check(statistics.staticOpcodes[(size_t)tok::OPCODE::MUL] == 1 && statistics.staticOpcodes[(size_t)tok::OPCODE::ADD] == 2, "the instructions are counted");
+        statistics.reset();
+        tok::compile("a*2+1", options).run(vector<double>{3.0});
+        uint64_t total = 0;
+        for (tok::STAGE stage : stages)
+            total += calls(stage);
+        check(total == 0 && statistics.staticOpcodes[(size_t)tok::OPCODE::MUL] == 0, "nothing is counted without instrumenting");
+        // The count is static: the skipped right operand of && counts too.
+        options.optimize = false;
+        tok::CompiledExpression skipping = tok::compile("b && a*2", options);
+        tok::trace().setInstrumenting(true);
+        skipping.run(vector<double>{0.0, 3.0});
+        tok::trace().setInstrumenting(false);
+        check(statistics.staticOpcodes[(size_t)tok::OPCODE::MUL] == 1 && statistics.staticOpcodes[(size_t)tok::OPCODE::LAND] == 1,
+              "the instructions are counted whether they run or not");
+#endif
+    }
+}
+
+/**
+ * test.exe runs every check and exits with a failure if one of them failed.
+ **/
+int main()
+{
+    kernels();
+    functions();
+    files();
+    cache();
+    rules();
+    integers();
+    optimizer();
+    jit();
+    superinstructions();
+    threadPool();
+    shortCircuit();
+    parser();
+    workbook();
+    tracing();
+    programFiles();
+    cout << checks - failures << " of " << checks << " checks passed" << endl;
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include "ThreadPool.hpp"
+
+tok::ThreadPool::ThreadPool(std::size_t threads)
+    : queues(new Queue[std::max<std::size_t>(threads, 1)]), threads(std::max<std::size_t>(threads, 1))
+{
+    for (std::size_t worker = 1; worker < this->threads; worker++)
+        this->workers.emplace_back(&tok::ThreadPool::loop, this, worker);
+}
+tok::ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stop = true;
+    }
+    this->wake.notify_all();
+    for (std::thread &worker : this->workers)
+        worker.join();
+}
+bool tok::ThreadPool::pop(std::size_t worker, std::size_t &index)
+{
+    Queue &queue = this->queues[worker];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.begin == queue.end)
+        return false;
+    index = queue.begin++;
+    return true;
+}
+bool tok::ThreadPool::steal(std::size_t worker)
+{
+    // Pick the victim with the most tasks left without locking, then check
+    // again under its lock.
+    std::size_t victim = worker;
+    std::size_t most = 0;
+    for (std::size_t other = 0; other < this->threads; other++)
+    {
+        if (other == worker)
+            continue;
+        Queue &queue = this->queues[other];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.end - queue.begin > most)
+        {
+            most = queue.end - queue.begin;
+            victim = other;
+        }
+    }
+    if (most == 0)
+        return false;
+    // Both queues are locked at once: a worker still stealing when the last
+    // task finished may find its own queue refilled by the next parallelFor,
+    // which it must not overwrite. std::scoped_lock cannot deadlock with the
+    // victim stealing from this worker in turn.
+    Queue &own = this->queues[worker];
+    Queue &queue = this->queues[victim];
+    std::scoped_lock guard(own.lock, queue.lock);
+    if (own.begin != own.end || queue.begin == queue.end)
+        return true;
+    // The back half, leaving the victim the tasks it is about to take.
+    own.begin = queue.end - (queue.end - queue.begin + 1) / 2;
+    own.end = queue.end;
+    queue.end = own.begin;
+    return true;
+}
+void tok::ThreadPool::work(std::size_t worker)
+{
+    std::size_t index;
+    while (true)
+    {
+        if (!this->pop(worker, index))
+        {
+            // Only give up once there is nothing left anywhere.
+            if (!this->steal(worker))
+                return;
+            continue;
+        }
+        try
+        {
+            (*this->task)(index);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            if (!this->error)
+                this->error = std::current_exception();
+        }
+        if (this->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->done.notify_all();
+        }
+    }
+}
+void tok::ThreadPool::loop(std::size_t worker)
+{
+    std::uint64_t seen = 0;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> guard(this->lock);
+            this->wake.wait(guard, [&]() { return this->stop || this->generation != seen; });
+            if (this->stop)
+                return;
+            seen = this->generation;
+        }
+        this->work(worker);
+    }
+}
+void tok::ThreadPool::parallelFor(std::size_t count, const std::function<void(std::size_t)> &task)
+{
+    if (count == 0)
+        return;
+    std::lock_guard<std::mutex> serial(this->submit);
+    this->task = &task;
+    this->error = nullptr;
+    this->remaining.store(count, std::memory_order_relaxed);
+    // Contiguous shares, so that neighbouring tasks run on the same thread:
+    for (std::size_t worker = 0; worker < this->threads; worker++)
+    {
+        Queue &queue = this->queues[worker];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        queue.begin = count * worker / this->threads;
+        queue.end = count * (worker + 1) / this->threads;
+    }
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->generation++;
+    }
+    this->wake.notify_all();
+    this->work(0);
+    std::unique_lock<std::mutex> guard(this->lock);
+    this->done.wait(guard, [&]() { return this->remaining.load(std::memory_order_acquire) == 0; });
+    if (this->error)
+        std::rethrow_exception(this->error);
+}
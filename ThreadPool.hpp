@@ -0,0 +1,74 @@
+#pragma once
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace tok
+{
+    /**
+     * A fixed set of worker threads running index ranges of tasks. Every
+     * worker starts on its own share of the range and takes the tasks from
+     * its front; a worker that runs out steals the back half of the largest
+     * share left, so uneven tasks still keep all of them busy.
+     **/
+    struct ThreadPool
+    {
+    private:
+        // The tasks a worker has left, [begin, end).
+        struct alignas(64) Queue
+        {
+            std::mutex lock;
+            std::size_t begin = 0;
+            std::size_t end = 0;
+        };
+        std::vector<std::thread> workers;
+        // One per worker, the first belongs to the thread calling parallelFor.
+        std::unique_ptr<Queue[]> queues;
+        std::size_t threads;
+        // Only one parallelFor runs at a time:
+        std::mutex submit;
+        std::mutex lock;
+        std::condition_variable wake;
+        std::condition_variable done;
+        const std::function<void(std::size_t)> *task = nullptr;
+        std::atomic<std::size_t> remaining{0};
+        std::uint64_t generation = 0;
+        bool stop = false;
+        std::exception_ptr error;
+
+        bool pop(std::size_t worker, std::size_t &index);
+        bool steal(std::size_t worker);
+        void work(std::size_t worker);
+        void loop(std::size_t worker);
+
+    public:
+        /**
+         * Start a pool that runs tasks on the given number of threads, the
+         * caller of parallelFor counting as one of them.
+         **/
+        explicit ThreadPool(std::size_t threads = std::thread::hardware_concurrency());
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+        ~ThreadPool();
+        inline std::size_t size() const
+        {
+            return this->threads;
+        }
+        /**
+         * Run task(i) for every i below count and return once all of them have
+         * finished. The first exception a task throws is rethrown here.
+         **/
+        void parallelFor(std::size_t count, const std::function<void(std::size_t)> &task);
+    };
+}
+
+#endif
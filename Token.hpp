@@ -3,30 +3,30 @@
 #define TOKEN_H
 
 #include <string>
+#include <string_view>
 #include <algorithm>
 #include <iostream>
 #include <vector>
 #include <deque>
 #include <memory>
+#include <stdexcept>
+#include "Program.hpp"
+#include "Arena.hpp"
 
 namespace tok
 {
     struct Token
     {
 
-        std::string value;
+        // The span of the source expression this token was read from.
+        std::string_view value;
         unsigned position;
-        enum
-        {
-            LEFT,
-            RIGHT
-        } ASSOCIATIVITY;
         Token()
         {
-            this->value = std::string("");
+            this->value = std::string_view();
             this->position = 0;
         }
-        Token(std::string &value, unsigned pos)
+        Token(std::string_view value, unsigned pos)
         {
             this->value = value;
             this->position = pos;
@@ -37,7 +37,7 @@ namespace tok
         /**
          * Return the numerical value of the token
          **/
-        std::string &getValue()
+        std::string_view getValue()
         {
             return this->value;
         }
@@ -47,10 +47,12 @@ namespace tok
         }
         virtual std::string toString()
         {
-            return this->value + " at " + std::to_string(this->position);
+            return std::string(this->value) + " at " + std::to_string(this->position);
         }
         // Overloadable functions:
         virtual unsigned getPrecedence() { return 0; };
+        // Whether a chain of equal operators groups from the right.
+        virtual bool isRightAssociative() { return false; };
         virtual bool isBinaryOperation() { return false; };
         virtual bool isUnaryOperation() { return false; };
         virtual bool isFunction() { return false; };
@@ -60,31 +62,41 @@ namespace tok
         virtual bool isLeftParen() { return false; };
         virtual bool isTernaryOperation() { return false; };
         virtual int getOperands() { return 0; }
+        virtual void setOperands(unsigned) {}
         virtual bool isComma() {return 0;}
         virtual void parsetoInfix(tok::Token *&tok, std::vector<tok::Token *> &tokens, std::vector<tok::Token *> &posfix, std::deque<tok::Token *> &operators)
         {
             posfix.push_back(tok);
         }
-        /** 
-         * Take a vector of numbers and evaluate the value of it using the 
-         * specified operation this class consists of.
+        /**
+         * The operation this token is compiled to. Constants additionally
+         * provide their value and variables the slot they are read from.
          * */
-        virtual double evaluate(std::deque<double> &) { return 0x0; };
+        virtual tok::OPCODE getOpcode() { return tok::OPCODE::CONST; };
+        virtual double getConstant() { return 0x0; };
+        virtual unsigned getSlot() { return 0; };
+        // The index of the called function in the function registry.
+        virtual unsigned getFunction() { return 0; };
         inline unsigned consume(std::vector<tok::Token *> &tokens)
         {
             tokens.push_back(this);
             return 1;
         }
     };
-    double eval(std::string);
-    std::vector<tok::Token *> tokenization(std::string);
+    double eval(std::string_view);
+    double eval(std::string_view, const std::unordered_map<std::string, double> &);
+    std::vector<tok::Token *> tokenization(std::string_view, tok::SymbolTable &, tok::Arena &);
     std::vector<tok::Token *> infixtopostfixO(std::vector<tok::Token *> tokens);
     std::vector<tok::Token *> infixtopostfix(std::vector<tok::Token *>);
     double evaluate(std::vector<tok::Token *>);
-    unsigned consumeVar(std::string, unsigned, std::vector<tok::Token *> &);
-    unsigned consumeLit(std::string, unsigned, std::vector<tok::Token *> &);
+    tok::CompiledExpression assemble(std::vector<tok::Token *>, tok::SymbolTable);
+    tok::CompiledExpression parse(const std::vector<tok::Token *> &, tok::SymbolTable);
+    unsigned consumeVar(std::string_view, unsigned, std::vector<tok::Token *> &, tok::SymbolTable &, tok::Arena &);
+    unsigned consumeLit(std::string_view, unsigned, std::vector<tok::Token *> &, tok::Arena &);
     void print(std::vector<tok::Token *>);
     void print(std::deque<tok::Token *>);
+    // The tokens on one line, for diagnostics.
+    std::string toString(const std::vector<tok::Token *> &);
     inline bool isLetter(char pos)
     {
         return (pos >= 'a' && pos <= 'z') || (pos >= 'A' && pos <= 'Z');
@@ -98,48 +110,120 @@ namespace tok
     {
         return one->getPrecedence() >= two->getPrecedence();
     }
-    inline bool lookup(std::string, std::string, int, std::vector<tok::Token *> &);
+    inline bool lookup(std::string_view, std::string_view, int);
+    /**
+     * Move the operators in front of the innermost left parenthesis to the
+     * postfix, leaving the parenthesis at the front.
+     **/
+    inline void popToParen(tok::Token *tok, std::vector<tok::Token *> &posfix, std::deque<tok::Token *> &operators)
+    {
+        while (!operators.empty() && !operators.front()->isLeftParen())
+        {
+            posfix.push_back(operators.front());
+            operators.pop_front();
+        }
+        if (operators.empty())
+            throw std::invalid_argument("Unbalanced parenthesis at " + std::to_string(tok->getPosition()));
+    }
+    // A comma ends one argument of the innermost call, which starts another one.
+    inline void nextArgument(tok::Token *tok, std::vector<tok::Token *> &posfix, std::deque<tok::Token *> &operators)
+    {
+        while (!operators.empty() && !operators.front()->isLeftParen())
+        {
+            posfix.push_back(operators.front());
+            operators.pop_front();
+        }
+        if (operators.size() < 2 || !operators[1]->isFunction())
+            throw std::invalid_argument("Comma outside of a function call at " + std::to_string(tok->getPosition()));
+        operators[1]->setOperands(operators[1]->getOperands() + 1);
+    }
+    // The ? of a ? b : c is right associative, it only pops what binds tighter.
+    inline void openTernary(tok::Token *tok, std::vector<tok::Token *> &posfix, std::deque<tok::Token *> &operators)
+    {
+        while (!operators.empty() && !operators.front()->isParenthesis() && operators.front()->getPrecedence() < tok->getPrecedence())
+        {
+            posfix.push_back(operators.front());
+            operators.pop_front();
+        }
+        operators.push_front(tok);
+    }
+    // The : completes the innermost ? that has none yet.
+    inline void closeTernary(tok::Token *tok, std::vector<tok::Token *> &posfix, std::deque<tok::Token *> &operators)
+    {
+        while (!operators.empty() && !operators.front()->isParenthesis() &&
+               !(operators.front()->isTernaryOperation() && operators.front()->getOperands() == 2))
+        {
+            posfix.push_back(operators.front());
+            operators.pop_front();
+        }
+        if (operators.empty() || operators.front()->isParenthesis())
+            throw std::invalid_argument(": without a ? at " + std::to_string(tok->getPosition()));
+        operators.front()->setOperands(3);
+    }
+    // A right parenthesis that directly follows its left one, as in f().
+    inline void closeParen(tok::Token *tok, bool empty, std::vector<tok::Token *> &posfix, std::deque<tok::Token *> &operators)
+    {
+        tok::popToParen(tok, posfix, operators);
+        operators.pop_front();
+        // The parenthesis closed the arguments of a call:
+        if (!operators.empty() && operators.front()->isFunction())
+        {
+            if (empty)
+                operators.front()->setOperands(0);
+            posfix.push_back(operators.front());
+            operators.pop_front();
+        }
+    }
     // The kompositor design pattern is used to create a hierarchical structure:
     struct Value : public tok::Token
     {
 
-        Value(std::string value, unsigned position)
+        Value(std::string_view value, unsigned position)
         {
             this->value = value;
             this->position = position;
         }
     };
     struct Comma : public tok::Token {
-        Comma(std::string str, unsigned pos) : tok::Token(str, pos) {}
+        Comma(std::string_view str, unsigned pos) : tok::Token(str, pos) {}
         Comma(unsigned pos) {
             this->value = ",";
             this->position = pos;
         }
         bool isComma() {return true;}
+        virtual void parsetoInfix(tok::Token *&tok, std::vector<tok::Token *> &tokens, std::vector<tok::Token *> &posfix, std::deque<tok::Token *> &operators)
+        {
+            tok::nextArgument(tok, posfix, operators);
+        }
     };
     struct Literal : public tok::Value
     {
+        // The value of the literal, converted once while tokenizing.
+        double number;
 
-        Literal(std::string value, unsigned position) : tok::Value(value, position)
+        Literal(std::string_view value, unsigned position, double number) : tok::Value(value, position), number(number)
         {
         }
         bool inline isLiteral() override
         {
             return true;
         }
-        virtual double evaluate(std::deque<double> &) { return std::stod(this->getValue()); };
+        double getConstant() override { return this->number; };
     };
     struct VARIABLE : public tok::Value
     {
+        // The slot this variable was resolved to in the symbol table.
+        unsigned slot;
 
-        VARIABLE(std::string value, unsigned position) : tok::Value(value, position)
+        VARIABLE(std::string_view value, unsigned position, unsigned slot) : tok::Value(value, position), slot(slot)
         {
         }
         virtual std::string toString()
         {
-            return "Variable " + this->value + " at " + std::to_string(this->position);
+            return "Variable " + std::string(this->value) + " at " + std::to_string(this->position);
         }
-        virtual double evaluate(std::deque<double> &) { return 0x1; };
+        tok::OPCODE getOpcode() override { return tok::OPCODE::LOAD; };
+        unsigned getSlot() override { return this->slot; };
     };
     struct Parenthesis : public tok::Token
     {
@@ -151,7 +235,7 @@ namespace tok
     struct LPAREN : public Parenthesis
     {
 
-        LPAREN(std::string value, unsigned position)
+        LPAREN(std::string_view value, unsigned position)
         {
             this->value = value;
             this->position = position;
@@ -169,7 +253,7 @@ namespace tok
     struct RPAREN : public Parenthesis
     {
 
-        RPAREN(std::string value, unsigned position)
+        RPAREN(std::string_view value, unsigned position)
         {
             this->value = value;
             this->position = position;
@@ -181,56 +265,67 @@ namespace tok
         }
         virtual void parsetoInfix(tok::Token *&tok, std::vector<tok::Token *> &tokens, std::vector<tok::Token *> &posfix, std::deque<tok::Token *> &operators)
         {
-            while (!(operators.front()->isLeftParen()))
-            {
-                posfix.push_back(operators.front());
-                operators.pop_front();
-            }
-            operators.pop_front();
+            bool empty = &tok != tokens.data() && (&tok)[-1]->isLeftParen();
+            tok::closeParen(tok, empty, posfix, operators);
         }
     };
     struct Operation : public tok::Token
     {
-        Operation(std::string value, unsigned position) : tok::Token(value, position)
+        Operation(std::string_view value, unsigned position) : tok::Token(value, position)
         {
         }
     };
     struct Function : Operation
     {
     private:
-        // The operands this function takes as it's parameters.
-        std::vector<double> operands;
+        // The number of arguments it is called with, counted while parsing.
+        unsigned operands;
+        // The index of the function in the function registry.
+        unsigned function;
     public:
-        Function(std::string value, unsigned position, unsigned operands=1) : Operation(value, position)
+        Function(std::string_view value, unsigned position, unsigned function) : Operation(value, position)
         {
-            this->value = value;
-            this->position = position;
-            this->operands = std::vector<double>(operands);
+            this->operands = 1;
+            this->function = function;
         }
         // The number of operands this function takes
-        inline int getOperands()
+        inline int getOperands() override
         {
-            return this->operands.size();
-        }
-        inline std::vector<double>& getOperand() {
             return this->operands;
         }
-        inline std::string toString()
+        inline void setOperands(unsigned operands) override
+        {
+            this->operands = operands;
+        }
+        inline std::string toString() override
+        {
+            return "Function " + std::string(this->value) + " at " + std::to_string(this->position);
+        }
+        bool inline isFunction() override
         {
-            return "Function " + this->value + " at " + std::to_string(this->position);
+            return true;
+        }
+        tok::OPCODE getOpcode() override { return tok::OPCODE::CALL; };
+        unsigned getFunction() override { return this->function; };
+        // Waits for its arguments behind the left parenthesis that follows.
+        virtual void parsetoInfix(tok::Token *&tok, std::vector<tok::Token *> &tokens, std::vector<tok::Token *> &posfix, std::deque<tok::Token *> &operators)
+        {
+            this->operands = 1;
+            operators.push_front(tok);
         }
-        double evaluate(std::deque<double> & toks) { 
-            return 0x1; // TODO: Implement actual function with parameters and values and stuff:
-        };
     };
     struct UnaryOp : public Operation
     {
-        UnaryOp(std::string value, unsigned position) : Operation(value, position)
+        UnaryOp(std::string_view value, unsigned position) : Operation(value, position)
         {
         }
         UnaryOp() : UnaryOp("", 0)
         {
         }
+        bool inline isUnaryOperation() override
+        {
+            return true;
+        }
         virtual void parsetoInfix(tok::Token *&tok, std::vector<tok::Token *> &tokens, std::vector<tok::Token *> &posfix, std::deque<tok::Token *> &operators)
         {
             operators.push_front(tok);
@@ -239,66 +334,49 @@ namespace tok
     struct UNADD : public UnaryOp
     {
 
-        UNADD(std::string value, unsigned position) : UnaryOp(value, position)
+        UNADD(std::string_view value, unsigned position) : UnaryOp(value, position)
         {
         }
-        unsigned inline getPrecedence() override
+        tok::OPCODE inline getOpcode() override
         {
-            return 3;
+            return tok::OPCODE::PLUS;
         }
-        double inline evaluate(std::deque<double> &operands) override
+        unsigned inline getPrecedence() override
         {
-            double operand;
-            if (operands.size() < 1)
-                return 0.0;
-            // The rightmost operand in the unary operation:
-            operand = operands.front();
-            operands.pop_front();
-            return operand;
+            return 3;
         }
     };
     struct LNOT : public UnaryOp
     {
-        LNOT(std::string string, int pos) : UnaryOp(string, pos) {}
-        unsigned inline getPrecedence() override
+        LNOT(std::string_view string, int pos) : UnaryOp(string, pos) {}
+        tok::OPCODE inline getOpcode() override
         {
-            return 3;
+            return tok::OPCODE::LNOT;
         }
-        double inline evaluate(std::deque<double> &operands) override
+        unsigned inline getPrecedence() override
         {
-            double operand;
-            if (operands.size() < 1)
-                return 0.0;
-            // The rightmost operand in the unary operation:
-            operand = operands.front();
-            operands.pop_front();
-            return !operand;
+            return 3;
         }
     };
     struct UNSUB : public UnaryOp
     {
 
-        UNSUB(std::string value, unsigned position) : UnaryOp(value, position)
+        UNSUB(std::string_view value, unsigned position) : UnaryOp(value, position)
         {
         }
-        unsigned inline getPrecedence() override
+        tok::OPCODE inline getOpcode() override
         {
-            return 3;
+            return tok::OPCODE::NEG;
         }
-        double evaluate(std::deque<double> &operands) override
+        unsigned inline getPrecedence() override
         {
-            double operand;
-            if (operands.size() < 1)
-                return 0.0;
-            operand = operands.front();
-            operands.pop_front();
-            return -operand;
+            return 3;
         }
     };
     struct BinaryOp : public Operation
     {
 
-        BinaryOp(std::string value, unsigned position) : Operation(value, position)
+        BinaryOp(std::string_view value, unsigned position) : Operation(value, position)
         {
         }
         bool inline isBinaryOperation() override
@@ -315,221 +393,197 @@ namespace tok
             operators.push_front(tok);
         }
     };
-    struct BINADD : public BinaryOp
+    /**
+     * The ? of a ? b : c. It only has all three operands once its : is read.
+     **/
+    struct TERNARY : public Operation
     {
+    private:
+        bool complete = false;
 
-        BINADD(std::string value, unsigned position) : BinaryOp::BinaryOp(value, position)
+    public:
+        TERNARY(std::string_view value, unsigned position) : Operation(value, position)
         {
         }
+        bool inline isTernaryOperation() override
+        {
+            return true;
+        }
+        int getOperands() override
+        {
+            return this->complete ? 3 : 2;
+        }
+        void setOperands(unsigned operands) override
+        {
+            this->complete = operands == 3;
+        }
+        tok::OPCODE inline getOpcode() override
+        {
+            return tok::OPCODE::SELECT;
+        }
         unsigned inline getPrecedence() override
         {
-            return 6;
+            return 15;
+        }
+        bool inline isRightAssociative() override
+        {
+            return true;
         }
-        double inline evaluate(std::deque<double> &operands) override
+        virtual void parsetoInfix(tok::Token *&tok, std::vector<tok::Token *> &tokens, std::vector<tok::Token *> &posfix, std::deque<tok::Token *> &operators)
         {
-            double operand1, operand2;
-            if (operands.size() < 2)
-                return 0.0;
-            // The rightmost operand in the binary operation:
-            operand2 = operands.front();
-            operands.pop_front();
-            // The leftmost operand in the binary operation:
-            operand1 = operands.front();
-            operands.pop_front();
-            return operand1 + operand2;
+            this->complete = false;
+            tok::openTernary(tok, posfix, operators);
         }
     };
-    struct BINSUB : public BinaryOp
+    // The : of a ? b : c, it never gets to the postfix itself.
+    struct COLON : public tok::Token
+    {
+        COLON(std::string_view value, unsigned position) : tok::Token(value, position)
+        {
+        }
+        bool inline isTernaryOperation() override
+        {
+            return true;
+        }
+        virtual void parsetoInfix(tok::Token *&tok, std::vector<tok::Token *> &tokens, std::vector<tok::Token *> &posfix, std::deque<tok::Token *> &operators)
+        {
+            tok::closeTernary(tok, posfix, operators);
+        }
+    };
+    struct BINADD : public BinaryOp
     {
 
-        BINSUB(std::string value, unsigned position) : BinaryOp::BinaryOp(value, position)
+        BINADD(std::string_view value, unsigned position) : BinaryOp::BinaryOp(value, position)
+        {
+        }
+        tok::OPCODE inline getOpcode() override
         {
+            return tok::OPCODE::ADD;
         }
         unsigned inline getPrecedence() override
         {
             return 6;
         }
-        double inline evaluate(std::deque<double> &operands) override
+    };
+    struct BINSUB : public BinaryOp
+    {
+
+        BINSUB(std::string_view value, unsigned position) : BinaryOp::BinaryOp(value, position)
+        {
+        }
+        tok::OPCODE inline getOpcode() override
+        {
+            return tok::OPCODE::SUB;
+        }
+        unsigned inline getPrecedence() override
         {
-            double operand1, operand2;
-            if (operands.size() < 2)
-                return 0.0;
-            // The rightmost operand in the binary operation:
-            operand2 = operands.front();
-            operands.pop_front();
-            // The leftmost operand in the binary operation:
-            operand1 = operands.front();
-            operands.pop_front();
-            return operand1 - operand2;
+            return 6;
         }
     };
     struct BAND : public BinaryOp
     {
 
-        BAND(std::string value, unsigned position) : BAND::BinaryOp(value, position)
+        BAND(std::string_view value, unsigned position) : BAND::BinaryOp(value, position)
         {
         }
-        unsigned inline getPrecedence() override
+        tok::OPCODE inline getOpcode() override
         {
-            return 10;
+            return tok::OPCODE::BAND;
         }
-        double inline evaluate(std::deque<double> &operands) override
+        unsigned inline getPrecedence() override
         {
-            double operand1, operand2;
-            if (operands.size() < 2)
-                return 0.0;
-            // The rightmost operand in the binary operation:
-            operand2 = operands.front();
-            operands.pop_front();
-            // The leftmost operand in the binary operation:
-            operand1 = operands.front();
-            operands.pop_front();
-            return (int)operand1 & (int)operand2;
+            return 10;
         }
     };
     struct LAND : public BinaryOp
     {
 
-        LAND(std::string value, unsigned position) : BinaryOp(value, position)
+        LAND(std::string_view value, unsigned position) : BinaryOp(value, position)
         {
         }
-        unsigned inline getPrecedence() override
+        tok::OPCODE inline getOpcode() override
         {
-            return 13;
+            return tok::OPCODE::LAND;
         }
-        double inline evaluate(std::deque<double> &operands) override
+        unsigned inline getPrecedence() override
         {
-            double operand1, operand2;
-            if (operands.size() < 2)
-                return 0.0;
-            // The rightmost operand in the binary operation:
-            operand2 = operands.front();
-            operands.pop_front();
-            // The leftmost operand in the binary operation:
-            operand1 = operands.front();
-            operands.pop_front();
-            return (int)operand1 && (int)operand2;
+            return 13;
         }
     };
     struct LOR : public BinaryOp
     {
 
-        LOR(std::string value, unsigned position) : BinaryOp(value, position)
+        LOR(std::string_view value, unsigned position) : BinaryOp(value, position)
         {
         }
-        unsigned inline getPrecedence() override
+        tok::OPCODE inline getOpcode() override
         {
-            return 14;
+            return tok::OPCODE::LOR;
         }
-        double inline evaluate(std::deque<double> &operands) override
+        unsigned inline getPrecedence() override
         {
-            double operand1, operand2;
-            if (operands.size() < 2)
-                return 0.0;
-            // The rightmost operand in the binary operation:
-            operand2 = operands.front();
-            operands.pop_front();
-            // The leftmost operand in the binary operation:
-            operand1 = operands.front();
-            operands.pop_front();
-            return (int)operand1 || (int)operand2;
+            return 14;
         }
     };
     struct BOR : public BinaryOp
     {
 
-        BOR(std::string value, unsigned position) : BinaryOp(value, position)
+        BOR(std::string_view value, unsigned position) : BinaryOp(value, position)
         {
         }
-        unsigned inline getPrecedence() override
+        tok::OPCODE inline getOpcode() override
         {
-            return 12;
+            return tok::OPCODE::BOR;
         }
-        double inline evaluate(std::deque<double> &operands) override
+        unsigned inline getPrecedence() override
         {
-            double operand1, operand2;
-            if (operands.size() < 2)
-                return 0.0;
-            // The rightmost operand in the binary operation:
-            operand2 = operands.front();
-            operands.pop_front();
-            // The leftmost operand in the binary operation:
-            operand1 = operands.front();
-            operands.pop_front();
-            return (int)operand1 | (int)operand2;
+            return 12;
         }
     };
     struct MULT : public BinaryOp
     {
 
-        MULT(std::string value, unsigned position) : BinaryOp::BinaryOp(value, position)
+        MULT(std::string_view value, unsigned position) : BinaryOp::BinaryOp(value, position)
         {
         }
-        unsigned inline getPrecedence() override
+        tok::OPCODE inline getOpcode() override
         {
-            return 5;
+            return tok::OPCODE::MUL;
         }
-        double inline evaluate(std::deque<double> &operands) override
+        unsigned inline getPrecedence() override
         {
-            double operand1, operand2;
-            if (operands.size() < 2)
-                return 0.0;
-            // The rightmost operand in the binary operation:
-            operand2 = operands.front();
-            operands.pop_front();
-            // The leftmost operand in the binary operation:
-            operand1 = operands.front();
-            operands.pop_front();
-            return operand1 * operand2;
+            return 5;
         }
     };
     struct MOD : public BinaryOp
     {
 
-        MOD(std::string value, unsigned position) : BinaryOp::BinaryOp(value, position)
+        MOD(std::string_view value, unsigned position) : BinaryOp::BinaryOp(value, position)
         {
         }
-        unsigned inline getPrecedence() override
+        tok::OPCODE inline getOpcode() override
         {
-            return 5;
+            return tok::OPCODE::MOD;
         }
-        double inline evaluate(std::deque<double> &operands) override
+        unsigned inline getPrecedence() override
         {
-            double operand1, operand2;
-            if (operands.size() < 2)
-                return 0.0;
-            // The rightmost operand in the binary operation:
-            operand2 = operands.front();
-            operands.pop_front();
-            // The leftmost operand in the binary operation:
-            operand1 = operands.front();
-            operands.pop_front();
-            return (int)operand1 % (int)operand2;
+            return 5;
         }
     };
     struct DIV : public BinaryOp
     {
 
-        DIV(std::string value, unsigned position) : BinaryOp::BinaryOp(value, position)
+        DIV(std::string_view value, unsigned position) : BinaryOp::BinaryOp(value, position)
+        {
+        }
+        tok::OPCODE inline getOpcode() override
         {
+            return tok::OPCODE::DIV;
         }
         unsigned inline getPrecedence() override
         {
             return 5;
         }
-        double inline evaluate(std::deque<double> &operands) override
-        {
-            double operand1, operand2;
-            if (operands.size() < 2)
-                return 0.0;
-            // The rightmost operand in the binary operation:
-            operand2 = operands.front();
-            operands.pop_front();
-            // The leftmost operand in the binary operation:
-            operand1 = operands.front();
-            operands.pop_front();
-            return operand1 / operand2;
-        }
     };
 }
 
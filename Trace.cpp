@@ -0,0 +1,103 @@
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+#include "Trace.hpp"
+
+tok::Statistics::Statistics()
+{
+    this->reset();
+}
+void tok::Statistics::reset()
+{
+    for (std::size_t stage = 0; stage < tok::STAGES; stage++)
+    {
+        this->nanoseconds[stage].store(0, std::memory_order_relaxed);
+        this->calls[stage].store(0, std::memory_order_relaxed);
+    }
+    for (std::atomic<std::uint64_t> &count : this->staticOpcodes)
+        count.store(0, std::memory_order_relaxed);
+    this->tokens.store(0, std::memory_order_relaxed);
+    this->allocations.store(0, std::memory_order_relaxed);
+    this->allocatedBytes.store(0, std::memory_order_relaxed);
+}
+void tok::Statistics::report(std::ostream &out) const
+{
+    static const char *const stages[] = {"tokenize", "parse", "assemble", "optimize", "evaluate"};
+    out << "stage\tcalls\tms\tns/call\n";
+    for (std::size_t stage = 0; stage < tok::STAGES; stage++)
+    {
+        std::uint64_t calls = this->calls[stage].load(std::memory_order_relaxed);
+        std::uint64_t ns = this->nanoseconds[stage].load(std::memory_order_relaxed);
+        out << stages[stage] << '\t' << calls << '\t' << ns / 1e6 << '\t' << (calls ? (double)ns / calls : 0.0) << '\n';
+    }
+    out << "tokens\t" << this->tokens.load(std::memory_order_relaxed) << '\n';
+    out << "arena allocations\t" << this->allocations.load(std::memory_order_relaxed) << '\t'
+        << this->allocatedBytes.load(std::memory_order_relaxed) << " bytes\n";
+    out << "instruction\tstatic count\n";
+    for (std::size_t op = 0; op < tok::OPCODES; op++)
+    {
+        std::uint64_t count = this->staticOpcodes[op].load(std::memory_order_relaxed);
+        if (count != 0)
+            out << tok::name((tok::OPCODE)op) << '\t' << count << '\n';
+    }
+}
+tok::Trace::Trace() : log(&std::cerr)
+{
+    const char *settings = std::getenv("TOK_TRACE");
+    if (!settings)
+        return;
+    std::string_view list = settings;
+    while (!list.empty())
+    {
+        std::size_t end = list.find(',');
+        std::string_view setting = list.substr(0, end);
+        if (setting == "log")
+            this->logging.store(true, std::memory_order_relaxed);
+        else if (setting == "stats")
+        {
+            this->instrumenting.store(true, std::memory_order_relaxed);
+            this->dumpRequested = true;
+        }
+        list.remove_prefix(end == std::string_view::npos ? list.size() : end + 1);
+    }
+}
+void tok::Trace::setLogging(bool logging, std::ostream *log)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+    if (log)
+        this->log = log;
+    this->logging.store(logging, std::memory_order_relaxed);
+}
+void tok::Trace::setInstrumenting(bool instrumenting)
+{
+    this->instrumenting.store(instrumenting, std::memory_order_relaxed);
+}
+void tok::Trace::dumpOnExit()
+{
+    static std::once_flag registered;
+    std::call_once(registered, []() {
+        std::atexit([]() {
+            std::ostringstream out;
+            tok::trace().statistics.report(out);
+            tok::trace().write(out.str());
+        });
+    });
+}
+void tok::Trace::write(const std::string &message)
+{
+    std::lock_guard<std::mutex> guard(this->lock);
+    *this->log << message << std::flush;
+}
+void tok::Trace::countProgram(const tok::CompiledExpression &program, std::uint64_t runs)
+{
+    for (const tok::Instruction &ins : program.getProgram())
+        this->statistics.staticOpcodes[(std::size_t)ins.op].fetch_add(runs, std::memory_order_relaxed);
+}
+tok::Trace &tok::trace()
+{
+    static tok::Trace trace;
+    // Registered once trace is complete, so that it outlives the handler.
+    static bool dumping = trace.dumpRequested && (trace.dumpOnExit(), true);
+    (void)dumping;
+    return trace;
+}
@@ -0,0 +1,184 @@
+#pragma once
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include "Program.hpp"
+
+/**
+ * Tracing and instrumentation are only compiled in with -DTOK_TRACE=1, the
+ * debug build of the makefile does so. Without it every macro below expands
+ * to an empty statement. Compiled in, both are still off until enabled at
+ * run time through tok::trace() or the environment variable TOK_TRACE, a
+ * comma separated list of:
+ *   log    write diagnostics like the tokens of every compiled expression
+ *   stats  collect the statistics and write them when the process exits
+ **/
+#ifndef TOK_TRACE
+#define TOK_TRACE 0
+#endif
+
+namespace tok
+{
+    /**
+     * The stages that are timed separately.
+     **/
+    enum class STAGE : std::uint8_t
+    {
+        TOKENIZE,
+        PARSE,
+        ASSEMBLE,
+        OPTIMIZE,
+        EVALUATE
+    };
+    const std::size_t STAGES = (std::size_t)STAGE::EVALUATE + 1;
+    /**
+     * Counters that are only ever added to, read through tok::trace().
+     **/
+    struct Statistics
+    {
+        std::atomic<std::uint64_t> nanoseconds[tok::STAGES];
+        std::atomic<std::uint64_t> calls[tok::STAGES];
+        std::atomic<std::uint64_t> tokens;
+        // The instructions of the programs that were run, every one of them
+        // once per row. A static count: the instructions a row jumps over,
+        // like the right operand of a false &&, are counted as well.
+        std::atomic<std::uint64_t> staticOpcodes[tok::OPCODES];
+        // The allocations from arenas and the bytes they asked for.
+        std::atomic<std::uint64_t> allocations;
+        std::atomic<std::uint64_t> allocatedBytes;
+
+        Statistics();
+        Statistics(const Statistics &) = delete;
+        Statistics &operator=(const Statistics &) = delete;
+        void reset();
+        void report(std::ostream &out) const;
+    };
+    struct Trace;
+    tok::Trace &trace();
+    struct Trace
+    {
+    private:
+        std::atomic<bool> logging{false};
+        std::atomic<bool> instrumenting{false};
+        std::mutex lock;
+        std::ostream *log;
+        // Whether the environment asked for the statistics on exit.
+        bool dumpRequested = false;
+
+        friend tok::Trace &trace();
+
+    public:
+        tok::Statistics statistics;
+
+        // Reads the initial settings from the environment.
+        Trace();
+        Trace(const Trace &) = delete;
+        Trace &operator=(const Trace &) = delete;
+        inline bool isLogging() const
+        {
+            return this->logging.load(std::memory_order_relaxed);
+        }
+        inline bool isInstrumenting() const
+        {
+            return this->instrumenting.load(std::memory_order_relaxed);
+        }
+        void setLogging(bool logging, std::ostream *log = nullptr);
+        void setInstrumenting(bool instrumenting);
+        /**
+         * Write the statistics to the log when the process exits.
+         **/
+        void dumpOnExit();
+        /**
+         * Write one whole message to the log, not interleaved with others.
+         **/
+        void write(const std::string &message);
+        /**
+         * Count every instruction of the program once per run, whether the
+         * run gets to it or not.
+         **/
+        void countProgram(const tok::CompiledExpression &program, std::uint64_t runs);
+    };
+    /**
+     * Adds the time from its construction to its destruction to a stage.
+     **/
+    struct StageTimer
+    {
+    private:
+        tok::STAGE stage;
+        bool active;
+        std::chrono::steady_clock::time_point start;
+
+    public:
+        explicit StageTimer(tok::STAGE stage) : stage(stage), active(tok::trace().isInstrumenting())
+        {
+            if (this->active)
+                this->start = std::chrono::steady_clock::now();
+        }
+        ~StageTimer()
+        {
+            if (!this->active)
+                return;
+            std::chrono::nanoseconds elapsed = std::chrono::steady_clock::now() - this->start;
+            tok::Statistics &statistics = tok::trace().statistics;
+            statistics.nanoseconds[(std::size_t)this->stage].fetch_add(elapsed.count(), std::memory_order_relaxed);
+            statistics.calls[(std::size_t)this->stage].fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+}
+
+#define TOK_CONCAT_(a, b) a##b
+#define TOK_CONCAT(a, b) TOK_CONCAT_(a, b)
+#if TOK_TRACE
+// Log a message built with <<, for example TOK_LOG("at " << position).
+#define TOK_LOG(message)                          \
+    do                                            \
+    {                                             \
+        if (tok::trace().isLogging())             \
+        {                                         \
+            std::ostringstream tokMessage;        \
+            tokMessage << message << '\n';        \
+            tok::trace().write(tokMessage.str()); \
+        }                                         \
+    } while (0)
+// Add n to one of the counters of tok::Statistics.
+#define TOK_COUNT(counter, n)                                                      \
+    do                                                                             \
+    {                                                                              \
+        if (tok::trace().isInstrumenting())                                        \
+            tok::trace().statistics.counter.fetch_add((n), std::memory_order_relaxed); \
+    } while (0)
+// Count the instructions of a program that is run for the given rows.
+#define TOK_COUNT_PROGRAM(program, runs)                  \
+    do                                                    \
+    {                                                     \
+        if (tok::trace().isInstrumenting())               \
+            tok::trace().countProgram((program), (runs)); \
+    } while (0)
+// Time the rest of the enclosing scope as the given stage.
+#define TOK_TIMER(stage) tok::StageTimer TOK_CONCAT(tokTimer, __LINE__)(tok::STAGE::stage)
+#else
+#define TOK_LOG(message) \
+    do                   \
+    {                    \
+    } while (0)
+#define TOK_COUNT(counter, n) \
+    do                        \
+    {                         \
+    } while (0)
+#define TOK_COUNT_PROGRAM(program, runs) \
+    do                                   \
+    {                                    \
+    } while (0)
+#define TOK_TIMER(stage) \
+    do                   \
+    {                    \
+    } while (0)
+#endif
+
+#endif
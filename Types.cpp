@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <sstream>
+#include "Program.hpp"
+#include "Functions.hpp"
+
+namespace
+{
+    // Whether the operation takes integer operands.
+    bool takesIntegers(tok::OPCODE op)
+    {
+        return op == tok::OPCODE::MOD || op == tok::OPCODE::BAND || op == tok::OPCODE::BOR;
+    }
+}
+tok::TYPE tok::resultType(tok::OPCODE op, const double *divisor)
+{
+    if (op == tok::OPCODE::BAND || op == tok::OPCODE::BOR)
+        return tok::TYPE::INTEGER;
+    // Only a divisor known not to be 0 never makes the result NaN.
+    if (op == tok::OPCODE::MOD && divisor && tok::integer(*divisor) != 0)
+        return tok::TYPE::INTEGER;
+    return tok::TYPE::REAL;
+}
+std::vector<tok::Typing> tok::inferTypes(const std::vector<tok::Instruction> &program, const std::vector<double> &constants)
+{
+    const std::size_t END = program.size();
+    // The instruction taking every value off the stack, END for the result,
+    // and the value every MOD divides by:
+    std::vector<std::size_t> consumer(program.size(), END);
+    std::vector<std::size_t> divisor(program.size(), END);
+    std::vector<std::size_t> stack;
+    for (std::size_t i = 0; i < program.size(); i++)
+    {
+        std::size_t operands = tok::operands(program[i]);
+        if (program[i].op == tok::OPCODE::MOD)
+            divisor[i] = stack.back();
+        for (std::size_t k = stack.size() - operands; k < stack.size(); k++)
+            consumer[stack[k]] = i;
+        stack.resize(stack.size() - operands);
+        stack.push_back(i);
+    }
+    // The type every value is wanted in, back to front: a unary plus and a
+    // STORE pass the value on as it is, so they want it in the type their
+    // own consumer does or in the one it comes in.
+    std::vector<bool> passed(program.size());
+    std::vector<tok::Typing> typing(program.size(), {tok::TYPE::REAL, tok::TYPE::REAL});
+    for (std::size_t i = program.size(); i-- > 0;)
+    {
+        std::size_t c = consumer[i];
+        if (c == END)
+            continue;
+        if (takesIntegers(program[c].op))
+        {
+            typing[i].consumed = tok::TYPE::INTEGER;
+        }
+        else if (program[c].op == tok::OPCODE::PLUS)
+        {
+            typing[i].consumed = typing[c].consumed;
+            passed[i] = passed[c];
+        }
+        else if (program[c].op == tok::OPCODE::STORE)
+        {
+            passed[i] = true;
+        }
+    }
+    // The type of every temporary:
+    std::vector<tok::TYPE> temporaries;
+    for (std::size_t i = 0; i < program.size(); i++)
+    {
+        const tok::Instruction &ins = program[i];
+        tok::TYPE &type = typing[i].type;
+        switch (ins.op)
+        {
+        case tok::OPCODE::CONST:
+        case tok::OPCODE::LOAD:
+            type = passed[i] ? tok::TYPE::REAL : typing[i].consumed;
+            break;
+        case tok::OPCODE::RECALL:
+            type = temporaries[ins.arg];
+            break;
+        // The operand has been converted for them already:
+        case tok::OPCODE::PLUS:
+            type = typing[i - 1].consumed;
+            break;
+        case tok::OPCODE::STORE:
+            type = typing[i - 1].consumed;
+            temporaries.resize(std::max<std::size_t>(temporaries.size(), ins.arg + 1));
+            temporaries[ins.arg] = type;
+            break;
+        case tok::OPCODE::MOD:
+        {
+            const tok::Instruction &d = program[divisor[i]];
+            type = tok::resultType(ins.op, d.op == tok::OPCODE::CONST ? &constants[d.arg] : nullptr);
+            break;
+        }
+        default:
+            type = tok::resultType(ins.op, nullptr);
+            break;
+        }
+        if (passed[i])
+            typing[i].consumed = type;
+    }
+    return typing;
+}
+std::string tok::typeReport(const tok::CompiledExpression &program)
+{
+    std::ostringstream report;
+    const std::vector<tok::Instruction> &code = program.getProgram();
+    const std::vector<tok::Typing> &typing = program.getTyping();
+    for (std::size_t i = 0; i < code.size(); i++)
+    {
+        const tok::Instruction &ins = code[i];
+        report << i << '\t' << tok::name(ins.op);
+        if (ins.op == tok::OPCODE::CONST)
+            report << ' ' << program.getConstants()[ins.arg];
+        else if (ins.op == tok::OPCODE::LOAD)
+            report << ' ' << program.getSymbols().getName(ins.arg);
+        else if (ins.op == tok::OPCODE::STORE || ins.op == tok::OPCODE::RECALL)
+            report << ' ' << ins.arg;
+        else if (ins.op == tok::OPCODE::CALL)
+            report << ' ' << tok::function(ins.arg).name;
+        report << '\t' << tok::name(typing[i].type);
+        if (typing[i].consumed != typing[i].type)
+            report << " -> " << tok::name(typing[i].consumed);
+        report << '\n';
+    }
+    return report.str();
+}
@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include "Workbook.hpp"
+#include "Functions.hpp"
+#include "Kernels.hpp"
+
+namespace
+{
+    const std::uint32_t NONE = UINT32_MAX;
+
+    // The graph always merges equal nodes, the identities it may apply
+    // follow the options.
+    tok::CompileOptions merging(tok::CompileOptions options)
+    {
+        options.optimize = true;
+        options.cse = true;
+        return options;
+    }
+}
+tok::Workbook::Workbook(const tok::CompileOptions &options) : options(options), graph(merging(options))
+{
+    // The formulas are only ever parsed to be lifted into the graph, which
+    // does the rewriting.
+    this->options.optimize = false;
+    this->options.jitThreshold = 0;
+}
+std::size_t tok::Workbook::add(std::string_view expr)
+{
+    tok::CompiledExpression program = tok::compile(expr, this->options);
+    // Every node is computed whenever its operands change, the arms of ?: and
+    // the right operand of && and || included. A call of an impure function
+    // would happen where run() skips it, and its value would go stale.
+    for (const tok::Instruction &ins : program.getProgram())
+    {
+        if (ins.op == tok::OPCODE::CALL && !tok::function(ins.arg).pure)
+            throw std::invalid_argument("A workbook cannot call the impure function " + std::string(tok::function(ins.arg).name));
+    }
+    std::uint32_t root = this->graph.lift(program, &this->symbols);
+    for (std::uint32_t index = this->values.size(); index < this->graph.getNodes().size(); index++)
+        this->wire(index);
+    this->formulas.push_back(root);
+    return this->formulas.size() - 1;
+}
+/**
+ * Type the node the graph just added, hook it up to its operands and
+ * compute it. Its operands are up to date, so the node is as well.
+ **/
+void tok::Workbook::wire(std::uint32_t index)
+{
+    const std::vector<tok::Node> &nodes = this->graph.getNodes();
+    const tok::Node &node = nodes[index];
+    this->dependents.emplace_back();
+    this->queued.push_back(false);
+    // A unary plus passes its operand on as it is.
+    if (node.op == tok::OPCODE::PLUS)
+        this->types.push_back(this->types[node.operand1]);
+    else if (node.op == tok::OPCODE::MOD && nodes[node.operand2].op == tok::OPCODE::CONST)
+        this->types.push_back(tok::resultType(node.op, &nodes[node.operand2].value));
+    else
+        this->types.push_back(tok::resultType(node.op, nullptr));
+    std::uint32_t operands[] = {node.operand1, node.operand2, node.operand3};
+    for (int i = 0; i < tok::operands(node); i++)
+    {
+        // An operand used twice, like in x*x, gets one entry.
+        std::vector<std::uint32_t> &users = this->dependents[operands[i]];
+        if (users.empty() || users.back() != index)
+            users.push_back(index);
+    }
+    if (node.op == tok::OPCODE::LOAD)
+    {
+        if (this->loads.size() <= node.arg)
+            this->loads.resize(node.arg + 1, NONE);
+        this->loads[node.arg] = index;
+        if (this->bindings.size() <= node.arg)
+            this->bindings.resize(node.arg + 1, std::numeric_limits<double>::quiet_NaN());
+    }
+    this->values.push_back(this->compute(index));
+}
+double tok::Workbook::real(std::uint32_t node) const
+{
+    double value = this->values[node];
+    return this->types[node] == tok::TYPE::INTEGER ? (double)tok::unpack(value) : value;
+}
+std::int64_t tok::Workbook::integer(std::uint32_t node) const
+{
+    double value = this->values[node];
+    return this->types[node] == tok::TYPE::INTEGER ? tok::unpack(value) : tok::integer(value);
+}
+/**
+ * Compute the node from the cached values of its operands, the same way
+ * run() does. The node is already typed.
+ **/
+double tok::Workbook::compute(std::uint32_t index) const
+{
+    const tok::Node &node = this->graph.getNodes()[index];
+    switch (node.op)
+    {
+    case tok::OPCODE::CONST:
+        return node.value;
+    case tok::OPCODE::LOAD:
+        return this->bindings[node.arg];
+    case tok::OPCODE::PLUS:
+        return this->values[node.operand1];
+    case tok::OPCODE::CALL:
+    {
+        double arguments[tok::MAX_ARITY];
+        std::uint32_t operands[] = {node.operand1, node.operand2, node.operand3};
+        for (unsigned i = 0; i < node.aux; i++)
+            arguments[i] = this->real(operands[i]);
+        return tok::function(node.arg).scalar(arguments);
+    }
+    case tok::OPCODE::SELECT:
+        return tok::isTrue(this->real(node.operand1)) ? this->real(node.operand2) : this->real(node.operand3);
+    case tok::OPCODE::BAND:
+        return tok::pack(this->integer(node.operand1) & this->integer(node.operand2));
+    case tok::OPCODE::BOR:
+        return tok::pack(this->integer(node.operand1) | this->integer(node.operand2));
+    case tok::OPCODE::MOD:
+    {
+        std::int64_t divisor = this->integer(node.operand2);
+        if (this->types[index] == tok::TYPE::INTEGER)
+            return tok::pack(tok::mod(this->integer(node.operand1), divisor));
+        return tok::remainder(this->integer(node.operand1), divisor);
+    }
+    default:
+        return tok::apply(node.op, this->real(node.operand1), tok::operands(node.op) == 2 ? this->real(node.operand2) : 0.0);
+    }
+}
+void tok::Workbook::mark(std::uint32_t node)
+{
+    if (this->queued[node])
+        return;
+    this->queued[node] = true;
+    this->dirty.push_back(node);
+    std::push_heap(this->dirty.begin(), this->dirty.end(), std::greater<std::uint32_t>());
+}
+void tok::Workbook::bind(unsigned slot, double value)
+{
+    if (this->bindings.size() <= slot)
+        this->bindings.resize(slot + 1, std::numeric_limits<double>::quiet_NaN());
+    this->bindings[slot] = value;
+    if (slot < this->loads.size() && this->loads[slot] != NONE)
+        this->mark(this->loads[slot]);
+}
+/**
+ * Recompute the dirty nodes lowest index first, which is after all of their
+ * operands. A node whose value stays the same to the bit does not dirty the
+ * nodes that depend on it.
+ **/
+std::size_t tok::Workbook::recompute()
+{
+    std::size_t count = 0;
+    while (!this->dirty.empty())
+    {
+        std::pop_heap(this->dirty.begin(), this->dirty.end(), std::greater<std::uint32_t>());
+        std::uint32_t index = this->dirty.back();
+        this->dirty.pop_back();
+        this->queued[index] = false;
+        double value = this->compute(index);
+        count++;
+        if (std::memcmp(&value, &this->values[index], sizeof(double)) == 0)
+            continue;
+        this->values[index] = value;
+        for (std::uint32_t dependent : this->dependents[index])
+            this->mark(dependent);
+    }
+    this->updateCount++;
+    this->lastCount = count;
+    this->totalCount += count;
+    return count;
+}
+std::size_t tok::Workbook::set(std::string_view name, double value)
+{
+    this->bind(this->symbols.resolve(name), value);
+    return this->recompute();
+}
+std::size_t tok::Workbook::set(const std::unordered_map<std::string, double> &values)
+{
+    for (const auto &binding : values)
+        this->bind(this->symbols.resolve(binding.first), binding.second);
+    return this->recompute();
+}
@@ -0,0 +1,116 @@
+#pragma once
+#ifndef WORKBOOK_H
+#define WORKBOOK_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "Program.hpp"
+#include "Optimizer.hpp"
+
+namespace tok
+{
+    /**
+     * Many formulas over a shared set of inputs, kept up to date as the
+     * inputs change one at a time. The formulas are merged into a single
+     * graph in which equal sub-expressions are one node, every node caching
+     * its value. Setting an input only recomputes the nodes that depend on
+     * it, in topological order, and stops wherever a value comes out the
+     * same as before.
+     **/
+    struct Workbook
+    {
+    private:
+        tok::SymbolTable symbols;
+        tok::CompileOptions options;
+        // Every operand of a node comes before it, so the indices are a
+        // topological order. The arrays below have an entry for every node.
+        tok::ExpressionGraph graph;
+        // The value of every node in its type, see tok::inferTypes: the
+        // integers of %, & and | are kept packed, so that they keep all of
+        // their bits like they do in run().
+        std::vector<double> values;
+        std::vector<tok::TYPE> types;
+        // The nodes that take every node as an operand.
+        std::vector<std::vector<std::uint32_t>> dependents;
+        // The LOAD node of every slot, NONE while no formula reads it.
+        std::vector<std::uint32_t> loads;
+        // The value of every slot, NaN until it is set.
+        std::vector<double> bindings;
+        // The node every formula computes.
+        std::vector<std::uint32_t> formulas;
+        // The nodes waiting to be recomputed as a min-heap, and whether a
+        // node is in there already.
+        std::vector<std::uint32_t> dirty;
+        std::vector<bool> queued;
+        std::uint64_t updateCount = 0;
+        std::uint64_t lastCount = 0;
+        std::uint64_t totalCount = 0;
+
+        void wire(std::uint32_t index);
+        double compute(std::uint32_t index) const;
+        // The value of the node as a double or as an integer.
+        double real(std::uint32_t node) const;
+        std::int64_t integer(std::uint32_t node) const;
+        void mark(std::uint32_t node);
+        void bind(unsigned slot, double value);
+        std::size_t recompute();
+
+    public:
+        explicit Workbook(const tok::CompileOptions &options = tok::CompileOptions());
+        /**
+         * Compile the formula into the workbook and return its index. Throws
+         * std::invalid_argument like compile() does, and for a formula that
+         * calls an impure function: the workbook computes every operand
+         * eagerly, even those run() skips, and keeps the values it computed.
+         **/
+        std::size_t add(std::string_view expr);
+        /**
+         * Set the input and recompute what depends on it. Returns the number
+         * of nodes that were recomputed.
+         **/
+        std::size_t set(std::string_view name, double value);
+        /**
+         * Set several inputs at once, recomputing every node only once.
+         **/
+        std::size_t set(const std::unordered_map<std::string, double> &values);
+        inline double get(std::size_t formula) const
+        {
+            return this->real(this->formulas.at(formula));
+        }
+        inline std::size_t size() const
+        {
+            return this->formulas.size();
+        }
+        inline const tok::SymbolTable &getSymbols() const
+        {
+            return this->symbols;
+        }
+        // The number of nodes all the formulas share.
+        inline std::size_t getNodes() const
+        {
+            return this->graph.getNodes().size();
+        }
+        inline std::size_t getShared() const
+        {
+            return this->graph.getEliminated();
+        }
+        // The number of updates so far and the nodes they recomputed.
+        inline std::uint64_t updates() const
+        {
+            return this->updateCount;
+        }
+        inline std::uint64_t lastRecomputed() const
+        {
+            return this->lastCount;
+        }
+        inline std::uint64_t recomputed() const
+        {
+            return this->totalCount;
+        }
+    };
+}
+
+#endif
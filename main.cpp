@@ -1,5 +1,10 @@
 #include <iostream>
+#include <stdexcept>
 #include "Token.hpp"
+#include "Profiler.hpp"
+#include "Cache.hpp"
+#include "Stream.hpp"
+#include "Binary.hpp"
 
 using namespace std;
 
@@ -8,5 +13,78 @@ int main(int argc, char **argv)
     // Some simple one-line non-inline comment!
     if (argc == 1)
         return EXIT_FAILURE;
-    cout << tok::eval(argv[1]) << endl;
-}
\ No newline at end of file
+    // --stream [file] [--bindings file.csv] evaluates one expression per line.
+    if (string(argv[1]) == "--stream")
+    {
+        tok::StreamOptions options;
+        for (int i = 2; i < argc; i++)
+        {
+            if (string(argv[i]) == "--bindings" && i + 1 < argc)
+                options.bindings = argv[++i];
+            else
+                options.input = argv[i];
+        }
+        try
+        {
+            return tok::stream(options) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        catch (const exception &e)
+        {
+            cerr << e.what() << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    // --precompile expressions.txt programs.bin compiles one expression per
+    // line into a program file that tok::ProgramFile loads without parsing.
+    if (string(argv[1]) == "--precompile")
+    {
+        if (argc != 4)
+            return EXIT_FAILURE;
+        try
+        {
+            cerr << tok::precompile(argv[2], argv[3]) << " expressions compiled" << endl;
+            return EXIT_SUCCESS;
+        }
+        catch (const exception &e)
+        {
+            cerr << e.what() << endl;
+            return EXIT_FAILURE;
+        }
+    }
+    // Every further argument binds a variable: name=value
+    // or is --profile-pairs to report the executed opcode pairs
+    // or --types to report the type of every instruction.
+    unordered_map<string, double> values;
+    bool types = false;
+    for (int i = 2; i < argc; i++)
+    {
+        string binding = argv[i];
+        if (binding == "--profile-pairs")
+        {
+            tok::pairProfile().enable();
+            continue;
+        }
+        if (binding == "--types")
+        {
+            types = true;
+            continue;
+        }
+        size_t eq = binding.find('=');
+        if (eq == string::npos)
+            return EXIT_FAILURE;
+        values[binding.substr(0, eq)] = stod(binding.substr(eq + 1));
+    }
+    try
+    {
+        cout << tok::eval(argv[1], values) << endl;
+        if (types)
+            cerr << tok::typeReport(*tok::cache().get(argv[1]));
+        if (tok::pairProfile().isEnabled())
+            tok::pairProfile().report(cerr);
+    }
+    catch (const exception &e)
+    {
+        cerr << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+}